@@ -4,12 +4,56 @@
  * No warranty is given.
  */
 
+// clock_gettime, mmap and strcasecmp are POSIX, madvise and the online core count are extensions
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+
 #include "fileparser.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifndef FILEPARSER_NO_THREADS
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+
+#if !defined(FILEPARSER_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define FILEPARSER_HAS_SSE2
+#include <emmintrin.h>
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define FILEPARSER_HAS_AVX2 // picked at runtime, so the library itself doesn't need -mavx2
+#include <immintrin.h>
+#endif
+#endif
+
 /* =============== MACROS ================ */
 #define INCREASE_CAP(cap) do {*cap <<= 1;} while (0)
 #define PARSER_COLUMN_CUSTOM_NAME "__column_%zu__"
@@ -18,13 +62,445 @@
 #define STRING_MAX_WIDTH 256
 #define MIN_CAPACITY 16
 #define INITIAL_TOKENS_CAPACITY 20
+#define NUMBER_BUFFER_CAPACITY 64
+#define SCAN_BLOCK_SIZE 64 // one bit per byte in a 64 bit mask
+#define ARENA_BLOCK_SIZE (1024 * 1024)
+#define ARENA_ALIGNMENT 16
+#define ARENA_HEADER_SIZE ((sizeof(PARSER_ARENA_BLOCK) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define FAST_NUMBER_MAX_DIGITS 19 // every 19 digit number fits into ull
+#if LDBL_MANT_DIG >= 113
+#define FAST_FLOAT_MAX_POW10 48 // 5^48 < 2^113, so 10^48 is exact
+#elif LDBL_MANT_DIG >= 64
+#define FAST_FLOAT_MAX_POW10 27 // 5^27 < 2^64, so 10^27 is exact
+#else
+#define FAST_FLOAT_MAX_POW10 22 // 5^22 < 2^53, so 10^22 is exact
+#endif
+#if LDBL_MANT_DIG >= 64
+#define FAST_FLOAT_MAX_MANTISSA ULLONG_MAX
+#else
+#define FAST_FLOAT_MAX_MANTISSA (1ULL << LDBL_MANT_DIG)
+#endif
+#define INSERTION_SORT_THRESHOLD 16
+#if LDBL_MANT_DIG == 64 && (defined(__x86_64__) || defined(__i386__) || defined(_M_IX86))
+#define RADIX_FLOAT_KEYS 80 // x87 extended precision, keys take 10 bytes
+#define RADIX_PASSES 10
+#elif LDBL_MANT_DIG == DBL_MANT_DIG
+#define RADIX_FLOAT_KEYS 64 // long double is just a double
+#define RADIX_PASSES 8
+#else
+#define RADIX_PASSES 8 // other formats fall back to comparison sort for floats
+#endif
+#define PARALLEL_MIN_CHUNK_SIZE (64 * 1024) // ranges smaller than that aren't worth a thread
+#define PARALLEL_MIN_SORT_SIZE (32 * 1024) // same for rows handed to a sorting thread
+#define PARALLEL_MIN_AGGREGATE_SIZE (32 * 1024) // and for rows aggregated by one thread
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define SAVE_BLOCK_ROWS (16 * 1024) // rows formatted by one thread at a time
+#define SCHEMA_SAMPLE_ROWS 1000
+#define DICTIONARY_MAX_SIZE (64 * 1024) // columns with more distinct strings aren't worth encoding
+#define STRING_TABLE_MIN_SLOTS 64
+#define SNAPSHOT_MAGIC "FPSNAP\r\n" // the line break catches files mangled by text mode transfers
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+#define SNAPSHOT_ALIGNMENT 64 // every section starts on a cache line, so mapped arrays are aligned for any type
+#ifdef FILEPARSER_STATS
+#define STATS_SAMPLE_LINES 64 // lines are timed phase by phase only once in that many
+#define STATS_ADD(counter, value) ((counter) += (value))
+#define STATS_START(timer) PARSER_TIMER timer; _stats_now(&timer)
+#define STATS_STOP(total, timer) _stats_stop(&(total), &(timer))
+#else
+#define STATS_ADD(counter, value) ((void)0)
+#define STATS_START(timer) ((void)0)
+#define STATS_STOP(total, timer) ((void)0)
+#endif
+#define TRACE_MIN_EVENTS 16
+#define TRACE_MAX_ARGS 8 // the rest of a message with more arguments is cut off
+#define TRACE_TEXT_SIZE 128 // bytes for the strings of one message
+#define TRACE_SPEC_SIZE 64
+#define TRACE_MESSAGE_SIZE 1024
+#ifdef FILEPARSER_NO_THREADS
+#define ATOMIC_LOAD(pointer) (*(pointer))
+#define ATOMIC_STORE(pointer, value) (*(pointer) = (value))
+#define ATOMIC_STORE_RELAXED(pointer, value) (*(pointer) = (value))
+#define ATOMIC_CLAIM(pointer) (*(pointer) ? 0 : (*(pointer) = 1))
+#define ATOMIC_CAS(pointer, expected, desired) (*(pointer) = (desired), 1)
+#define ATOMIC_FETCH_ADD(pointer, value) ((*(pointer) += (value)) - (value))
+#define ATOMIC_FENCE_RELEASE() ((void)0)
+#define ATOMIC_FENCE_ACQUIRE() ((void)0)
+#define DEFAULTS_LOCK() ((void)0)
+#define DEFAULTS_UNLOCK() ((void)0)
+#else
+#define ATOMIC_LOAD(pointer) __atomic_load_n(pointer, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE(pointer, value) __atomic_store_n(pointer, value, __ATOMIC_RELEASE)
+#define ATOMIC_STORE_RELAXED(pointer, value) __atomic_store_n(pointer, value, __ATOMIC_RELAXED)
+#define ATOMIC_CLAIM(pointer) (__atomic_exchange_n(pointer, 1, __ATOMIC_ACQ_REL) == 0)
+#define ATOMIC_CAS(pointer, expected, desired) __atomic_compare_exchange_n(pointer, expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define ATOMIC_FETCH_ADD(pointer, value) __atomic_fetch_add(pointer, value, __ATOMIC_RELAXED)
+#define ATOMIC_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define ATOMIC_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define DEFAULTS_LOCK() pthread_mutex_lock(&defaults_lock)
+#define DEFAULTS_UNLOCK() pthread_mutex_unlock(&defaults_lock)
+#endif
 
 /* =============== TYPES ================ */
 typedef FILE* P_PFILE;
-typedef int (*QuickSortComp)(size_t, size_t, size_t, PARSER*);
+
+typedef struct __output_buffer
+{
+    char* data;
+    size_t length;
+    size_t capacity;
+    P_PFILE file; // full buffers are written here, without a file the buffer just grows
+    int failed;
+} OUTPUT_BUFFER;
 
 typedef void (*PrintHandler)(CONTAINER_DATA*);
-typedef void (*SaveHandler)(CONTAINER_DATA*, FILE*, char);
+typedef void (*SaveHandler)(const CONTAINER_DATA*, OUTPUT_BUFFER*);
+
+struct __parser_arena_block
+{
+    struct __parser_arena_block* next;
+    size_t capacity;
+    size_t used;
+};
+
+typedef enum __lazy_mode
+{
+    LAZY_OFF,
+    LAZY_SLICES, // cells point into the input buffer
+    LAZY_COPIES // the input buffer is reused, so the raw text is copied into the arena
+} LAZY_MODE;
+
+typedef struct __string_table
+{
+    char** values; // interned strings in the order they were met, the code of a string is its index
+    unsigned* hashes;
+    size_t count;
+    size_t capacity;
+    unsigned* slots; // open addressing, 0 is an empty slot, code + 1 otherwise
+    size_t slot_count; // power of two, at least twice the number of values
+    int disabled; // too many distinct strings (or no memory), the column isn't encoded
+} STRING_TABLE;
+
+typedef struct __row_filter
+{
+    const PARSER_FILTER* filters;
+    size_t filter_count;
+    RowFilter callback;
+    void* data;
+} ROW_FILTER;
+
+typedef struct __parse_state
+{
+    CONTAINER_DATA** lines;
+    LINE_INFO* info;
+    size_t line_count;
+    size_t column_count;
+    size_t capacity;
+    PARSER_ARENA arena; // rows and strings of this state, moved to the parser when done
+    LAZY_MODE lazy;
+    int quoted; // fields can be quoted, splitters and line breaks between quotes don't count
+
+    size_t sample_start; // first data row of the schema sample
+    size_t sample_size; // rows still to be sampled, 0 once the schema is fixed
+    const PARSER_SCHEMA_COLUMN* schema; // every row after the sample is parsed with it
+    size_t schema_size;
+    PARSER_SCHEMA_COLUMN* inferred; // owned by the state until it's moved to the container
+
+    int encode_strings; // dictionary encoding is on
+    STRING_TABLE* dictionaries; // one table per column met so far, codes of the cells are local to this state
+    size_t dictionary_count;
+
+    const size_t* projection; // input field of every kept column, NULL keeps all fields
+    size_t projection_count;
+
+    ROW_FILTER filter;
+    CONTAINER_DATA* filter_row; // scratch line handed to the filter callback
+    size_t filter_row_capacity;
+    char* filter_text; // strings of the scratch line
+    size_t filter_text_capacity;
+
+#ifdef FILEPARSER_STATS
+    PARSER_STATS stats; // counters of this state, the timers only add up the timed lines
+    size_t stats_lines; // lines handed to _push_line
+    double stats_mark; // wall clock when the line before the next timed one was done
+#endif
+} PARSE_STATE;
+
+typedef struct __index_slot
+{
+    uint64_t hash;
+    size_t key_row; // a row holding the key of this slot
+    size_t first; // the rows of the key are rows[first .. first + count)
+    size_t count; // 0 marks an empty slot
+} INDEX_SLOT;
+
+struct __parser_index
+{
+    size_t column;
+    size_t* rows; // data rows grouped by key, every group in ascending order
+    INDEX_SLOT* slots; // open addressing over the distinct keys
+    size_t slot_count; // power of two
+    PARSER_INDEX* next;
+};
+
+typedef struct __sort_item
+{
+    CONTAINER_DATA cell; // the first sort key
+    const CONTAINER_DATA* keys; // the other sort keys of the row, NULL when sorting by one column
+    size_t index;
+} SORT_ITEM;
+
+typedef struct __radix_item
+{
+    uint64_t low;
+    uint64_t high;
+    size_t index;
+} RADIX_ITEM;
+
+typedef struct __sort_context
+{
+    const PARSER_CONTAINER* container;
+    const size_t* columns; // column of every sort key
+    const PARSER_SORT_SETTINGS* keys;
+    size_t key_count;
+    const PARSER_DICTIONARY** dictionaries; // dictionary of every key column, NULL for columns without one
+    DATA_TYPE key_type; // type of the radix keys, NULL_TYPE when comparison sort is used
+#ifdef FILEPARSER_STATS
+    size_t* comparisons; // counter of the thread using this context
+#endif
+} SORT_CONTEXT;
+
+typedef struct __sort_task
+{
+    const SORT_CONTEXT* context;
+    size_t* indices;
+    size_t count;
+    int result;
+#ifdef FILEPARSER_STATS
+    size_t comparisons;
+#endif
+} SORT_TASK;
+
+typedef struct __merge_task
+{
+    const SORT_CONTEXT* context;
+    const size_t* left;
+    size_t left_count;
+    const size_t* right;
+    size_t right_count;
+    size_t* output; // output of the whole merge, the task only writes [output_begin, output_end)
+    size_t output_begin;
+    size_t output_end;
+#ifdef FILEPARSER_STATS
+    size_t comparisons;
+#endif
+} MERGE_TASK;
+
+typedef enum __number_result
+{
+    NUMBER_PARSED,
+    NUMBER_STRING,
+    NUMBER_UNKNOWN // rare forms that only libc knows how to convert
+} NUMBER_RESULT;
+
+typedef struct __block_masks
+{
+    uint64_t splitter;
+    uint64_t newline;
+    uint64_t quote;
+} BLOCK_MASKS;
+
+typedef void (*BlockScanner)(const char*, char, BLOCK_MASKS*);
+
+typedef struct __line_scanner
+{
+    const char* line_start;
+    const char* end;
+    const char* block;
+    const char* next_block;
+    uint64_t mask; // positions of the current block that are not handed out yet
+    char splitter;
+
+    const char** separators; // splitter positions of the last returned line
+    size_t separator_count;
+    size_t separator_capacity;
+
+    int quoted; // splitters and line breaks between quotes are skipped
+    uint64_t inside; // all ones when the last loaded block ended between quotes
+    uint64_t last_quote; // 1 when the last byte of that block was a quote, for "" split between blocks
+    const char* last_escape; // last "" inside quotes met so far, NULL if none
+    char* unescaped; // the last returned line without its "" escapes, when it had some
+    size_t unescaped_capacity;
+    int transient; // the last returned line is in unescaped, so it's gone with the next one
+} LINE_SCANNER;
+
+typedef struct __parse_task
+{
+    PARSE_STATE state;
+    const char* begin;
+    const char* end;
+    char splitter;
+    int quoted;
+    LAZY_MODE lazy;
+    const PARSER_SCHEMA_COLUMN* schema; // shared with the main state, read only
+    size_t schema_size;
+    int encode_strings;
+    const size_t* projection; // shared with the main state too
+    size_t projection_count;
+    ROW_FILTER filter;
+    int result;
+} PARSE_TASK;
+
+typedef struct __save_task
+{
+    const PARSER_CONTAINER* container;
+    size_t begin;
+    size_t end;
+    char splitter;
+    OUTPUT_BUFFER output;
+} SAVE_TASK;
+
+typedef struct __aggregate_value
+{
+    size_t count; // non NULL cells for AGGREGATE_COUNT, numbers for the other functions
+    ull integer_sum; // sum of the integers, wraps around like every unsigned sum
+    CONTAINER_DATA value; // float sum of every number for AGGREGATE_SUM and AGGREGATE_MEAN, the extreme for AGGREGATE_MIN and AGGREGATE_MAX
+} AGGREGATE_VALUE;
+
+typedef struct __group_slot
+{
+    uint64_t hash;
+    size_t group; // group number + 1, 0 marks an empty slot
+} GROUP_SLOT;
+
+typedef struct __group_table
+{
+    const PARSER_CONTAINER* container;
+    const size_t* columns; // group columns
+    size_t column_count;
+    const PARSER_AGGREGATION* aggregations;
+    size_t aggregation_count;
+    GROUP_SLOT* slots;
+    size_t slot_count;
+    size_t* rows; // first row of every group, in the order the groups were met
+    AGGREGATE_VALUE* values; // aggregation_count values for every group
+    size_t group_count;
+    size_t group_capacity;
+} GROUP_TABLE;
+
+typedef struct __aggregate_task
+{
+    GROUP_TABLE table;
+    size_t begin;
+    size_t end;
+    int result;
+} AGGREGATE_TASK;
+
+typedef struct __file_view
+{
+    const char* data;
+    size_t size;
+} FILE_VIEW;
+
+// snapshot files are the columnar layout written out, every pointer turned into a file (or heap) offset
+typedef struct __snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size_of_offset; // the arrays are used in place, so the platform has to match
+    uint32_t size_of_code;
+    uint32_t size_of_value;
+    uint32_t float_digits;
+    uint64_t file_size;
+    uint64_t line_count;
+    uint64_t column_count;
+    uint32_t header_included;
+    uint32_t sorted;
+    uint64_t sorted_column;
+    uint32_t sort_direction;
+    uint32_t case_sensitive;
+    uint64_t columns_offset; // column_count SNAPSHOT_COLUMNs
+    uint64_t header_offset; // column_count SNAPSHOT_CELLs, 0 without a header
+    uint64_t schema_offset; // column_count SNAPSHOT_SCHEMAs, 0 without a schema
+    uint64_t heap_offset;
+    uint64_t heap_size;
+} SNAPSHOT_HEADER;
+
+typedef struct __snapshot_column
+{
+    uint32_t type;
+    uint32_t mixed; // the column has a types array and DATA_VAR values
+    uint64_t nulls_offset;
+    uint64_t types_offset;
+    uint64_t values_offset; // 0 for columns of NULLs only
+    uint64_t dictionary_count;
+    uint64_t dictionary_offset; // heap offsets of the dictionary values (uint64_t each)
+    uint64_t folded_offset;
+} SNAPSHOT_COLUMN;
+
+typedef struct __snapshot_cell
+{
+    uint64_t type;
+    DATA_VAR value; // strings keep their heap offset in .integer
+} SNAPSHOT_CELL;
+
+typedef struct __snapshot_schema
+{
+    uint32_t type;
+    uint32_t nullable;
+} SNAPSHOT_SCHEMA;
+
+// one argument of a traced message, kept as it was passed
+typedef union __trace_arg
+{
+    long long integer; // any integer, unsigned ones are cast back when the message is formatted
+    double floating;
+    long double long_floating;
+    const void* pointer;
+    unsigned short text; // offset of a copied string in the text of the event
+} TRACE_ARG;
+
+// traced messages are stored unformatted: the format, the arguments and a copy of the strings they point to
+typedef struct __trace_event
+{
+    unsigned version; // odd while the owning thread writes the slot
+    unsigned thread;
+    size_t index; // position in the history of the ring, tells a slot that got reused apart
+    unsigned long long time; // ns since the trace was enabled
+    const char* format;
+    const char* function;
+    const char* file;
+    int line;
+    unsigned char level;
+    unsigned char arg_count;
+    unsigned short text_length;
+    TRACE_ARG args[TRACE_MAX_ARGS];
+    char text[TRACE_TEXT_SIZE];
+} TRACE_EVENT;
+
+// every thread writes into its own ring, so writers never wait for each other or for a dump
+typedef struct __trace_ring
+{
+    struct __trace_ring* next; // rings are never freed, the ring of a finished thread is taken over by the next one
+    TRACE_EVENT* events;
+    size_t capacity; // power of two
+    size_t head; // events written so far, only the owning thread changes it
+    size_t dumped; // events already dumped, only dump_log_trace touches it
+    int owned;
+    unsigned thread; // number of the owning thread, events keep the one they were written with
+} TRACE_RING;
+
+typedef struct __trace_spec
+{
+    const char* start; // the '%'
+    const char* end; // one past the conversion
+    int width_from_arg;
+    int precision_from_arg;
+    int precision; // -1 if there is none or it comes from an argument
+    char length[3]; // h, hh, l, ll, z, j, t or L
+    char conversion;
+} TRACE_SPEC;
 
 typedef struct __parser_type_handelrs
 {
@@ -34,34 +510,224 @@ typedef struct __parser_type_handelrs
 
 /* =============== PRIVATE FUNCTIONS ================ */
 static void _init_parser();
+static void _init_once();
 static PARSER_SETTINGS _create_default_parser_settings();
 static PARSER_SORT_SETTINGS _create_default_parser_sort_settings();
 
 static int _parse_file(PARSER* parser, P_PFILE file_to_parse);
-static CONTAINER_DATA* _parse_line(const char* line, char splitter, size_t* token_count);
-static CONTAINER_DATA _parse_token(char* token);
-
-static int _check_for_quotes(char* str, size_t len);
-static char* _trim_whitespace(char* str);
-static char* _trim_newlines(char* str);
-static char* _remove_quotes(char* str);
-static char* _create_new_header(size_t i);
-static void _check_and_fix_header(P_PARSER parser);
-static void _check_and_fix_parsed_data(P_PARSER parser);
-
-static int _compare_cells(
-    const size_t a_idx,
-    const size_t b_idx,
-    const size_t sort_column,
-    PARSER* parser);
-static void _quick_sort(PARSER* parser, size_t sort_column, QuickSortComp comp_func, size_t left, size_t right, size_t* indices);
-static size_t _partition(PARSER* parser, size_t sort_column, QuickSortComp comp_func, size_t left, size_t right, size_t* indices);
-static inline void _swap(size_t* a, size_t* b);
+static int _parse_buffer(PARSER* parser, const char* data, size_t size);
+static int _parse_remaining(PARSER* parser, PARSE_STATE* state, LINE_SCANNER* scanner);
+static int _parse_appended(PARSER* parser, const char* data, size_t begin, size_t end);
+static int _finish_append(PARSER* parser, PARSE_STATE* state);
+static size_t* _index_columns(const PARSER* parser, size_t* count);
+static void _build_indexes(PARSER* parser, const size_t* columns, size_t count);
+static int _parse_range(PARSE_STATE* state, const char* begin, const char* end, char splitter);
+static int _parse_range_parallel(PARSE_STATE* state, const char* begin, const char* end, char splitter, size_t thread_count);
+#ifndef FILEPARSER_NO_THREADS
+static void* _parse_task_run(void* arg);
+static const char* _next_line_start(const char* current, const char* end);
+#endif
+static const char* _find_record_end(const char* current, const char* end, int inside);
+static size_t _count_quotes(const char* text, size_t length);
+static size_t _resolve_thread_count(size_t thread_count);
+static int _read_line(P_PFILE file, char** buffer, size_t* capacity, size_t* length, PARSE_STATE* state);
+static int _init_parse_state(PARSE_STATE* state);
+static int _push_line(PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length, int is_header);
+static int _store_line(PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length, int is_header);
+static void _free_parse_state(PARSE_STATE* state);
+static int _resolve_projection(const PARSER_SETTINGS* settings, PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length);
+static int _filter_line(PARSE_STATE* state, const char* line, size_t length, const char* const* separators, size_t separator_count, int* keep);
+static void _filter_field(const PARSE_STATE* state, const char* line, size_t length, const char* const* separators, size_t separator_count, size_t column, CONTAINER_DATA* cell, const char** text, size_t* text_length);
+static int _filter_match(const CONTAINER_DATA* cell, const char* text, size_t length, const PARSER_FILTER* filter);
+static void _free_filter_scratch(PARSE_STATE* state);
+static void _finish_schema(PARSER* parser, PARSE_STATE* state);
+static int _grow_dictionaries(PARSE_STATE* state, size_t count);
+#ifndef FILEPARSER_NO_THREADS
+static int _merge_dictionaries(PARSE_STATE* state, PARSE_STATE* local);
+#endif
+static void _free_dictionaries(PARSE_STATE* state);
+static void _finish_dictionaries(PARSER* parser, PARSE_STATE* state);
+static int _finish_parse(PARSER* parser, PARSE_STATE* state, int header_included);
+static CONTAINER_DATA* _parse_line(const char* line, size_t length, const char* const* separators, size_t separator_count, size_t* token_count, PARSE_STATE* state, int is_header, int transient);
+static CONTAINER_DATA _parse_token(const char* token, size_t length, PARSER_ARENA* arena, DATA_TYPE expected, STRING_TABLE* dictionary, int quoted);
+static void _classify_token(const char** token, size_t* length, CONTAINER_DATA* data, int quoted);
+static int _classify_typed_token(const char** token, size_t* length, CONTAINER_DATA* data, DATA_TYPE expected, int quoted);
+static inline int _parse_digits(const char* token, size_t length, CONTAINER_DATA* data);
+static void _infer_schema(PARSE_STATE* state);
+static CONTAINER_DATA _make_raw(const char* token, size_t length, PARSER_ARENA* arena, LAZY_MODE lazy);
+static inline LAZY_MODE _lazy_mode(const PARSER* parser, int copies);
+static void _release_source(PARSER* parser);
+static NUMBER_RESULT _parse_number(const char* token, size_t length, CONTAINER_DATA* data);
+
+static int _scanner_init(LINE_SCANNER* scanner, char splitter, int quoted);
+static void _scanner_reset(LINE_SCANNER* scanner, const char* begin, const char* end);
+static void _scanner_free(LINE_SCANNER* scanner);
+static int _scanner_next_line(LINE_SCANNER* scanner, const char** line, size_t* length);
+static void _scanner_load_block(LINE_SCANNER* scanner);
+static int _scanner_unescape(LINE_SCANNER* scanner, const char** line, size_t* length);
+static inline uint64_t _prefix_xor(uint64_t mask);
+static void _scan_block_scalar(const char* block, char splitter, BLOCK_MASKS* masks);
+#ifdef FILEPARSER_HAS_SSE2
+static void _scan_block_sse2(const char* block, char splitter, BLOCK_MASKS* masks);
+#endif
+#ifdef FILEPARSER_HAS_AVX2
+static void _scan_block_avx2(const char* block, char splitter, BLOCK_MASKS* masks);
+#endif
+static BlockScanner _select_block_scanner();
+static inline unsigned _count_trailing_zeros(uint64_t mask);
+static inline unsigned _count_leading_zeros(uint64_t mask);
+
+static void _arena_init(PARSER_ARENA* arena);
+static void* _arena_alloc(PARSER_ARENA* arena, size_t size);
+static void* _arena_alloc_bytes(PARSER_ARENA* arena, size_t size);
+static char* _arena_strndup(PARSER_ARENA* arena, const char* str, size_t length);
+static CONTAINER_DATA* _arena_resize_row(PARSER_ARENA* arena, CONTAINER_DATA* row, size_t old_count, size_t new_count);
+static void _arena_merge(PARSER_ARENA* arena, PARSER_ARENA* other);
+static void _arena_free(PARSER_ARENA* arena);
+
+static int _map_file(const char* filename, FILE_VIEW* view, int writable);
+static void _unmap_file(FILE_VIEW* view);
+
+static int _check_for_quotes(const char* str, size_t len);
+static void _trim_span(const char** str, size_t* len);
+static void _remove_quotes(const char** str, size_t* len);
+static void _remove_enclosing_quotes(const char** str, size_t* len);
+static char* _create_new_header(size_t i, PARSER_ARENA* arena);
+static int _check_and_fix_header(P_PARSER parser);
+static int _check_and_fix_parsed_data(P_PARSER parser, size_t first_line);
+
+static int _sort_container(PARSER* parser, const PARSER_SORT_SETTINGS* keys, size_t key_count);
+static int _resolve_sort_column(const PARSER_CONTAINER* container, const PARSER_SORT_SETTINGS* settings, size_t* column);
+static int _sort_indices(PARSER* parser, const size_t* columns, const PARSER_SORT_SETTINGS* keys, size_t key_count, size_t* indices, size_t count);
+static int _column_type(const PARSER_CONTAINER* container, size_t sort_column, const size_t* indices, size_t count, DATA_TYPE* type);
+static int _sort_run(const SORT_CONTEXT* context, size_t* indices, size_t count);
+static int _sort_parallel(const SORT_CONTEXT* context, size_t* indices, size_t count, size_t thread_count);
+#ifndef FILEPARSER_NO_THREADS
+static void* _sort_task_run(void* arg);
+static void* _merge_task_run(void* arg);
+static size_t _merge_path_split(const SORT_CONTEXT* context, const size_t* left, size_t left_count, const size_t* right, size_t right_count, size_t diagonal);
+static int _compare_rows(const SORT_CONTEXT* context, size_t row_a, size_t row_b);
+#endif
+static int _radix_sort(const SORT_CONTEXT* context, size_t* indices, size_t count);
+static void _radix_key(const SORT_CONTEXT* context, const CONTAINER_DATA* cell, uint64_t* low, uint64_t* high);
+static inline unsigned _radix_byte(const RADIX_ITEM* item, size_t pass);
+static void _intro_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context);
+static void _intro_sort_loop(SORT_ITEM* items, size_t count, size_t depth, const SORT_CONTEXT* context);
+static size_t _partition(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context);
+static void _heap_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context);
+static void _sift_down(SORT_ITEM* items, size_t root, size_t count, const SORT_CONTEXT* context);
+static void _insertion_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context);
+static inline int _compare_items(const SORT_ITEM* a, const SORT_ITEM* b, const SORT_CONTEXT* context);
+static int _compare_cells(const CONTAINER_DATA* cell_a, const CONTAINER_DATA* cell_b, const PARSER_SORT_SETTINGS* settings, const PARSER_DICTIONARY* dictionary);
+static inline int _compare_nan(bigfloat a, bigfloat b);
+static inline void _swap_items(SORT_ITEM* a, SORT_ITEM* b);
 
 static void _print_formatted_row(PARSER* parser, size_t row_idx, const size_t* col_widths);
 
+static int _output_init(OUTPUT_BUFFER* output, P_PFILE file, size_t capacity);
+static int _output_reserve(OUTPUT_BUFFER* output, size_t size);
+static void _output_write(OUTPUT_BUFFER* output, const char* data, size_t length);
+static inline void _output_char(OUTPUT_BUFFER* output, char c);
+static int _output_flush(OUTPUT_BUFFER* output);
+static void _output_free(OUTPUT_BUFFER* output);
+static void _save_rows(const PARSER_CONTAINER* container, size_t begin, size_t end, char splitter, OUTPUT_BUFFER* output);
+static int _save_parallel(const PARSER_CONTAINER* container, char splitter, OUTPUT_BUFFER* output, size_t thread_count);
+#ifndef FILEPARSER_NO_THREADS
+static void* _save_task_run(void* arg);
+#endif
+static size_t _format_integer(ull value, char* buffer);
+static size_t _format_float(bigfloat value, char* buffer, size_t size);
+
+static inline unsigned _hash_string(const char* str, size_t length);
+static int _string_table_add(STRING_TABLE* table, const char* str, size_t length, unsigned hash, PARSER_ARENA* arena, unsigned* code);
+static int _string_table_grow(STRING_TABLE* table);
+static void _string_table_disable(STRING_TABLE* table);
+static int _compare_dictionary_values(const void* a, const void* b);
+static int _compare_dictionary_values_nocase(const void* a, const void* b);
+static void _free_container_dictionaries(PARSER_CONTAINER* container);
+static inline const PARSER_DICTIONARY* _column_dictionary(const PARSER_CONTAINER* container, size_t column);
+
+static int _snapshot_layout(const PARSER* parser, SNAPSHOT_HEADER* header, SNAPSHOT_COLUMN* columns);
+static void _snapshot_write(const PARSER_CONTAINER* container, const SNAPSHOT_HEADER* header, const SNAPSHOT_COLUMN* columns, OUTPUT_BUFFER* output);
+static inline void _snapshot_put(OUTPUT_BUFFER* output, uint64_t* position, const void* data, size_t size);
+static void _snapshot_pad(OUTPUT_BUFFER* output, uint64_t* position, uint64_t offset);
+static inline uint64_t _snapshot_align(uint64_t offset);
+static inline size_t _snapshot_element_size(const SNAPSHOT_COLUMN* column);
+static int _snapshot_check(const SNAPSHOT_HEADER* header, size_t size);
+static int _snapshot_array_fits(size_t size, uint64_t offset, uint64_t count, size_t element_size);
+static int _snapshot_check_values(const PARSER_COLUMN* column, size_t data_count, size_t heap_size);
+static int _snapshot_attach(const FILE_VIEW* view, PARSER_CONTAINER* container, PARSER_ARENA* arena);
+
+static int _search_bound(PARSER* parser, const CONTAINER_DATA* value, int upper, size_t* row);
+
+static uint64_t _hash_cell(const CONTAINER_DATA* cell);
+static int _cells_equal(const CONTAINER_DATA* a, const CONTAINER_DATA* b);
+static INDEX_SLOT* _index_find(const PARSER_INDEX* index, const PARSER_CONTAINER* container, const CONTAINER_DATA* key, uint64_t hash);
+static int _update_indexes(PARSER* parser, const size_t* order, size_t count, size_t start_index);
+static void _sort_update_indexes(PARSER* parser, const size_t* order, size_t count, size_t start_index);
+static void _free_index(PARSER_INDEX* index);
+static void _free_indexes(PARSER* parser);
+static int _compare_row_numbers(const void* a, const void* b);
+
+static int _group_table_init(GROUP_TABLE* table, const PARSER_CONTAINER* container, const size_t* columns, size_t column_count, const PARSER_AGGREGATION* aggregations, size_t aggregation_count);
+static void _group_table_free(GROUP_TABLE* table);
+static uint64_t _group_hash(const GROUP_TABLE* table, size_t row);
+static int _group_find(GROUP_TABLE* table, size_t row, uint64_t hash, size_t* group);
+static int _group_table_grow(GROUP_TABLE* table);
+static int _aggregate_rows(GROUP_TABLE* table, size_t begin, size_t end);
+static int _aggregate_parallel(GROUP_TABLE* table, size_t begin, size_t end, size_t thread_count);
+#ifndef FILEPARSER_NO_THREADS
+static void* _aggregate_task_run(void* arg);
+#endif
+static void _aggregate_add(AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function, const CONTAINER_DATA* cell);
+#ifndef FILEPARSER_NO_THREADS
+static void _aggregate_merge(AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function, const AGGREGATE_VALUE* other);
+#endif
+static CONTAINER_DATA _aggregate_result(const AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function);
+static inline int _compare_numbers(const CONTAINER_DATA* a, const CONTAINER_DATA* b);
+static CONTAINER_DATA _aggregate_cell(const PARSER_CONTAINER* container, size_t row, size_t column);
+static int _fill_aggregate(PARSER* result, const PARSER* parser, const GROUP_TABLE* table);
+
+static CONTAINER_DATA _get_cell(const PARSER_CONTAINER* container, size_t row, size_t column);
+static inline size_t _row_length(const PARSER_CONTAINER* container, size_t row);
+static int _convert_to_columnar(PARSER* parser);
+static inline void _materialize_cell(PARSER_ARENA* arena, CONTAINER_DATA* cell);
+static void _materialize_row(PARSER* parser, size_t row);
+static void _materialize_column(PARSER* parser, size_t column);
+static int _permute_columns(PARSER_CONTAINER* container, const size_t* order, size_t count);
+
+static void _log_to_stderr(int level, const char* function, const char* file, int line, const char* format, va_list args);
+static unsigned long long _trace_clock();
+static TRACE_RING* _trace_create_ring(size_t capacity);
+static TRACE_RING* _trace_ring();
+#ifndef FILEPARSER_NO_THREADS
+static void _trace_create_key();
+static void _trace_release(void* ring);
+#endif
+static void _trace_record(TRACE_RING* ring, int level, const char* function, const char* file, int line, const char* format, va_list* args);
+static const char* _trace_parse_spec(const char* c, TRACE_SPEC* spec);
+static size_t _trace_spec_args(const TRACE_SPEC* spec);
+static long long _trace_integer_arg(const TRACE_SPEC* spec, va_list* args);
+static void _trace_capture(TRACE_EVENT* event, const char* format, va_list* args);
+static int _trace_print_integer(char* buffer, size_t size, const char* piece, const TRACE_SPEC* spec, long long value);
+static void _trace_append(char* message, size_t size, size_t* used, const char* text, size_t length);
+static void _trace_format(const TRACE_EVENT* event, char* message, size_t size);
+static int _trace_compare_events(const void* a, const void* b);
+
+#ifdef FILEPARSER_STATS
+static double _stats_wall();
+static void _stats_now(PARSER_TIMER* now);
+static void _stats_stop(PARSER_TIMER* total, const PARSER_TIMER* start);
+static int _stats_line_start(PARSE_STATE* state, double* line_start);
+static void _stats_line_done(PARSE_STATE* state, int timed, double line_start);
+static inline void _stats_add_timer(PARSER_TIMER* timer, const PARSER_TIMER* other);
+static void _stats_merge(PARSER_STATS* stats, const PARSER_STATS* other);
+static void _stats_add_parse(PARSER* parser, const PARSE_STATE* state, const PARSER_TIMER* start);
+#endif
+
 static size_t _count_utf8_chars(const char* s);
 static char* _container_value_to_str(CONTAINER_DATA* data);
+static void _format_value(const CONTAINER_DATA* data, char* buffer, size_t size);
 static inline void _set_string(CONTAINER_DATA* data, char* str);
 static inline void _set_null(CONTAINER_DATA* data);
 
@@ -82,44 +748,98 @@ static inline void _print_null(CONTAINER_DATA* data)
 {
     printf("NULL ");
 }
+static inline void _print_raw(CONTAINER_DATA* data)
+{
+    printf("%.*s ", (int)data->value.raw.length, data->value.raw.data);
+}
 
-static inline void _save_string(CONTAINER_DATA* data, FILE* file, char splitter)
+static inline void _save_string(const CONTAINER_DATA* data, OUTPUT_BUFFER* output)
 {
-    fprintf(file, "%s%c", data->value.string, splitter);
+    _output_write(output, data->value.string, strlen(data->value.string));
 }
-static inline void _save_integer(CONTAINER_DATA* data, FILE* file, char splitter)
+static inline void _save_integer(const CONTAINER_DATA* data, OUTPUT_BUFFER* output)
 {
-    fprintf(file, "%llu%c", data->value.integer, splitter);
+    if (_output_reserve(output, NUMBER_BUFFER_CAPACITY)) return;
+    output->length += _format_integer(data->value.integer, output->data + output->length);
 }
-static inline void _save_float(CONTAINER_DATA* data, FILE* file, char splitter)
+static inline void _save_float(const CONTAINER_DATA* data, OUTPUT_BUFFER* output)
 {
-    fprintf(file, "%Lf%c", data->value.floating, splitter);
+    if (_output_reserve(output, NUMBER_BUFFER_CAPACITY)) return;
+    output->length += _format_float(data->value.floating, output->data + output->length, NUMBER_BUFFER_CAPACITY);
 }
-static inline void _save_null(CONTAINER_DATA* data, FILE* file, char splitter)
+static inline void _save_null(const CONTAINER_DATA* data, OUTPUT_BUFFER* output)
 {
-    fprintf(file, "NULL%c", splitter);
+    (void)data;
+    _output_write(output, "NULL", 4);
 }
+static inline void _save_raw(const CONTAINER_DATA* data, OUTPUT_BUFFER* output)
+{
+    // converted on the fly and not cached, so saving threads never write into the container
+    const char* token = data->value.raw.data;
+    size_t length = data->value.raw.length;
+    CONTAINER_DATA value;
+    _classify_token(&token, &length, &value, 0);
+
+    switch (value.type)
+        {
+            case STRING_TYPE: _output_write(output, token, length); break;
+            case INTEGER_TYPE: _save_integer(&value, output); break;
+            case FLOAT_TYPE: _save_float(&value, output); break;
+            default: _save_null(&value, output); break;
+        }
+}
+
+static const bigfloat powers_of_ten[] =
+{
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+    1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L, 1e28L, 1e29L,
+    1e30L, 1e31L, 1e32L, 1e33L, 1e34L, 1e35L, 1e36L, 1e37L, 1e38L, 1e39L,
+    1e40L, 1e41L, 1e42L, 1e43L, 1e44L, 1e45L, 1e46L, 1e47L, 1e48L
+};
 
 static TYPE_HANDLERS handlers[] =
 {
     [INTEGER_TYPE] = {_print_integer, _save_integer},
     [STRING_TYPE ]  = {_print_string,  _save_string},
     [FLOAT_TYPE	 ]   = {_print_float,   _save_float},
-    [NULL_TYPE	 ]   = {_print_null,    _save_null}
+    [NULL_TYPE	 ]   = {_print_null,    _save_null},
+    [RAW_TYPE    ]   = {_print_raw,     _save_raw}
 };
 
 /* =============== STATIC VARS ================ */
 static PARSER_SETTINGS DEFAULT_PARSER_SETTINGS;
 static PARSER_SORT_SETTINGS DEFAULT_PARSER_SORT_SETTINGS;
 
+static BlockScanner scan_block = _scan_block_scalar;
+
 static int system_initialized = 0;
 static int parser_settings_initialized = 0;
 static int parser_sort_settings_initialized = 0;
+#ifndef FILEPARSER_NO_THREADS
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t defaults_lock = PTHREAD_MUTEX_INITIALIZER; // parsers copy the defaults while they may be changed
+#endif
+
+int parser_log_level = LOG_LEVEL > LOGLEVEL_DEBUG ? -1 : LOG_LEVEL;
+
+static size_t trace_capacity = 0; // events per thread, 0 writes the log straight to stderr
+static TRACE_RING* trace_rings = NULL;
+static unsigned trace_threads = 0;
+static unsigned long long trace_start = 0;
+#ifdef FILEPARSER_NO_THREADS
+static TRACE_RING* trace_ring = NULL;
+#else
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+static int trace_key_failed = 0;
+static pthread_mutex_t trace_dump_lock = PTHREAD_MUTEX_INITIALIZER; // dumps are rare, only they are serialized
+#endif
 
 /* =============== PUBLIC ================ */
 P_PARSER create_parser()
 {
-    if (system_initialized ^ 1) _init_parser();
+    _init_once();
 
     P_PARSER parser = malloc(sizeof(PARSER));
     if (parser == NULL)
@@ -133,13 +853,53 @@ P_PARSER create_parser()
     parser->container.line_count = 0;
     parser->container.column_count = 0;
     parser->container.header_included = 0;
+    parser->container.layout = ROW_LAYOUT;
+    parser->container.columns = NULL;
+    parser->container.header = NULL;
+    parser->container.string_heap = NULL;
+    parser->container.string_heap_size = 0;
+    parser->container.schema = NULL;
+    parser->container.dictionaries = NULL;
+    DEFAULTS_LOCK();
     parser->settings = DEFAULT_PARSER_SETTINGS;
+    DEFAULTS_UNLOCK();
+    parser->source = NULL;
+    parser->source_size = 0;
+    parser->follow_offset = 0;
+    parser->indexes = NULL;
+    parser->sorted = 0;
+    parser->sorted_column = 0;
+    memset(&parser->stats, 0, sizeof(PARSER_STATS));
+    _arena_init(&parser->arena);
     return parser;
 }
 
 int parse_file(PARSER* parser, const char* filename)
 {
-    if (system_initialized ^ 1) _init_parser();
+    _init_once();
+
+    // parallel parsing splits the whole input into ranges, so it always works on the mapped file
+    if (parser->settings.use_mmap || parser->settings.thread_count != 1)
+        {
+            FILE_VIEW view;
+            STATS_START(mapping);
+            if (_map_file(filename, &view, 0) == 0)
+                {
+                    STATS_STOP(parser->stats.reading, mapping);
+                    int result = _parse_buffer(parser, view.data, view.size);
+
+                    // lazy cells point into the mapping, so it stays until the parser is freed
+                    if (result == 0 && _lazy_mode(parser, 0) != LAZY_OFF)
+                        {
+                            _release_source(parser);
+                            parser->source = view.data;
+                            parser->source_size = view.size;
+                        }
+                    else _unmap_file(&view);
+                    return result;
+                }
+            PARSER_LOG_WARNING("FAILED TO MAP FILE: %s, FALLING BACK TO STDIO", filename);
+        }
 
     P_PFILE target_file = fopen(filename, "r");
     if (target_file == NULL)
@@ -148,157 +908,266 @@ int parse_file(PARSER* parser, const char* filename)
             return 1;
         }
 
-    if(_parse_file(parser, target_file))
-        return 1;
-
+    int result = _parse_file(parser, target_file);
     fclose(target_file);
 
-    return 0;
+    return result;
 }
 
-int sort_data(PARSER* parser, PARSER_SORT_SETTINGS settings)
+int refresh_file(PARSER* parser, const char* filename)
 {
-    if (!parser || parser->container.line_count == 0 || parser->container.column_count == 0)
+    _init_once();
+
+    if (!parser)
         {
-            PARSER_LOG_CRITICAL("INVALID PARSER CONTAINER STATE");
+            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR REFRESHING");
             return 1;
         }
 
-    PARSER_CONTAINER* container = &parser->container;
-    size_t line_count = container->line_count;
-    size_t target_column_idx = -1;
+    // the file is mapped every time, only the pages after the last refresh are read
+    FILE_VIEW view;
+    STATS_START(mapping);
+    if (_map_file(filename, &view, 0))
+        {
+            PARSER_LOG_CRITICAL("FAILED TO MAP FILE: %s", filename);
+            return 1;
+        }
+    STATS_STOP(parser->stats.reading, mapping);
 
-    // checking if everything is okay and getting column idx
-    if (settings.tag == COLUMN_INDEX)
+    // a line that is still being written is left for the next refresh
+    size_t complete = view.size;
+    if (parser->settings.quoted_fields)
         {
-            if (settings.value.column_index >= container->column_count)
-                {
-                    PARSER_LOG_CRITICAL("%zu EXCEEDS NUMBER OF COLUMNS IN PARSED DATA [MAX: %zu]",
-                                        settings.value.column_index, container->column_count);
-                    return 1;
-                }
-            else target_column_idx = settings.value.column_index;
+            // a '\n' between quotes doesn't end a record, so the records are followed from the last refresh on
+            complete = (parser->follow_offset <= view.size) ? parser->follow_offset : 0;
+            const char* record_end;
+            while ((record_end = _find_record_end(view.data + complete, view.data + view.size, 0)))
+                complete = record_end - view.data;
         }
-    else if (settings.tag == COLUMN_NAME)
+    else while (complete > 0 && view.data[complete - 1] != '\n') complete--;
+
+    size_t offset = parser->follow_offset;
+    if (offset > complete)
         {
-            if (container->header_included ^ 1)
-                {
-                    PARSER_LOG_CRITICAL("TRYING TO SORT FOR %s BUT NO HEADER IN PARSED DATA", settings.value.column_name);
-                    return 1;
-                }
+            PARSER_LOG_WARNING("FILE %s GOT SHORTER, PARSING IT AGAIN", filename);
+            offset = 0;
+        }
 
-            else
+    // new lines can only be joined to plain rows, columns and dictionaries are built again from the whole file
+    int result = 0;
+    if (offset > 0 && offset == complete)
+        PARSER_LOG_INFO("NOTHING NEW IN %s", filename);
+    else if (offset > 0 && parser->container.layout == ROW_LAYOUT && !parser->container.dictionaries)
+        result = _parse_appended(parser, view.data, offset, complete);
+    else
+        {
+            // a parse drops the indexes, they are built again on the new data
+            size_t index_count;
+            size_t* index_columns = _index_columns(parser, &index_count);
+            result = _parse_buffer(parser, view.data, complete);
+            if (result == 0) _build_indexes(parser, index_columns, index_count);
+            free(index_columns);
+
+            // lazy cells point into the mapping, so it stays until the parser is freed
+            if (result == 0 && _lazy_mode(parser, 0) != LAZY_OFF)
                 {
-                    int found = 0;
-                    size_t i;
-                    CONTAINER_DATA* first_line = container->lines[0];
-                    PARSER_LOG_INFO("LOOKING FOR: %s", settings.value.column_name);
-                    for (i = 0; i < container->info[0].token_count && found == 0; i++)
-                        {
-                            PARSER_LOG_INFO("COMAPRING WITH: %s", first_line[i].value.string);
-                            if (first_line->type == STRING_TYPE && strcasecmp(first_line[i].value.string, settings.value.column_name) == 0)
-                                {
-                                    PARSER_LOG_INFO("FOUND THE HEADER %s [COLUMN: %zu]", settings.value.column_name, i);
-                                    found = 1;
-                                    break;
-                                }
-
-                        }
-                    if (found) target_column_idx = i;
-                    else
-                        {
-                            PARSER_LOG_CRITICAL("COULDN'T FIND THE HEADER: %s", settings.value.column_name);
-                            return 1;
-                        }
+                    _release_source(parser);
+                    parser->source = view.data;
+                    parser->source_size = view.size;
+                    view.data = NULL;
                 }
         }
+    _unmap_file(&view);
 
-    // sorting logic
-    parser->sort_settings = settings;
-
-    LINE_INFO* old_info = container->info;
-    CONTAINER_DATA** old_lines = container->lines;
+    if (result == 0) parser->follow_offset = complete;
+    return result;
+}
 
-    size_t start_index = (container->header_included) ? 1 : 0;
-    size_t data_count = line_count - start_index;
+int sort_data(PARSER* parser, PARSER_SORT_SETTINGS settings)
+{
+    return sort_data_by_keys(parser, &settings, 1);
+}
 
-    if (data_count <= 0)
+int sort_data_by_keys(PARSER* parser, const PARSER_SORT_SETTINGS* keys, size_t key_count)
+{
+    if (!parser || parser->container.line_count == 0 || parser->container.column_count == 0)
         {
-            PARSER_LOG_CRITICAL("NOTHING TO SORT");
+            PARSER_LOG_CRITICAL("INVALID PARSER CONTAINER STATE");
             return 1;
         }
 
-    size_t* indices = malloc(data_count * sizeof(size_t));
-    LINE_INFO* sorted_info = malloc(line_count * sizeof(LINE_INFO));
-    CONTAINER_DATA** sorted_lines = malloc(line_count * sizeof(CONTAINER_DATA*));
-
-    if (!indices || !sorted_info || !sorted_lines)
+    if (!keys || key_count == 0)
         {
-            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
-            free(indices);
-            free(sorted_info);
-            free(sorted_lines);
+            PARSER_LOG_CRITICAL("NO SORT KEYS GIVEN");
             return 1;
         }
 
-    for (size_t i = 0; i < data_count; i++) indices[i] = start_index + i;
+    // every failure below returns through here, so the timer is always stopped
+    STATS_START(sorting);
+    int result = _sort_container(parser, keys, key_count);
+    STATS_STOP(parser->stats.sorting, sorting);
+
+    return result;
+}
 
-    _quick_sort(parser, target_column_idx, _compare_cells, 0, data_count-1, indices); // shitty sort
+int save_data(PARSER* parser, const char* filename)
+{
+    P_PFILE target_file = (parser) ? fopen(filename, "w") : NULL;
 
-    for (size_t i = 0; i < data_count; i++)
+    if (target_file == NULL)
         {
-            sorted_info[start_index + i] = old_info[indices[i]];
-            sorted_lines[start_index + i] = old_lines[indices[i]];
+            PARSER_LOG_CRITICAL("FAILED TO OPEN FILE FOR WRITING: %s", filename);
+            return 1;
         }
-    if (container->header_included)
+
+    // the output buffer is big enough on its own, every flush becomes one write
+    setvbuf(target_file, NULL, _IONBF, 0);
+    STATS_START(saving);
+
+    OUTPUT_BUFFER output;
+    if (_output_init(&output, target_file, OUTPUT_BUFFER_SIZE))
         {
-            sorted_info[0] = old_info[0];
-            sorted_lines[0] = old_lines[0];
+            fclose(target_file);
+            return 1;
         }
 
-    free(container->lines);
-    free(container->info);
-    free(indices);
+    PARSER_CONTAINER* container = &parser->container;
+    size_t line_count = container->line_count;
+    char splitter = parser->settings.splitter;
 
-    container->lines = sorted_lines;
-    container->info = sorted_info;
+    size_t thread_count = _resolve_thread_count(parser->settings.thread_count);
+    size_t max_threads = line_count / SAVE_BLOCK_ROWS;
+    if (thread_count > max_threads) thread_count = max_threads;
 
-    return 0;
+    if (thread_count > 1)
+        output.failed |= _save_parallel(container, splitter, &output, thread_count);
+    else
+        _save_rows(container, 0, line_count, splitter, &output);
+
+    int result = _output_flush(&output);
+    _output_free(&output);
+
+#ifdef FILEPARSER_STATS
+    // nothing is buffered by stdio, so the position is what was written
+    long written = ftell(target_file);
+    if (written > 0) parser->stats.bytes_written += (size_t)written;
+#endif
+
+    if (fclose(target_file) != 0) result = 1;
+    STATS_STOP(parser->stats.saving, saving);
+    if (result) PARSER_LOG_CRITICAL("FAILED TO WRITE FILE: %s", filename);
+    return result;
 }
 
-int save_data(PARSER* parser, const char* filename)
+int save_snapshot(PARSER* parser, const char* filename)
 {
-    P_PFILE target_file = fopen(filename, "w");
+    if (!parser || (parser->container.lines == NULL && parser->container.columns == NULL))
+        {
+            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR SNAPSHOT");
+            return 1;
+        }
+
+    // the snapshot keeps typed values only, so lazy cells are converted first
+    for (size_t j = 0; j < parser->container.column_count; j++)
+        _materialize_column(parser, j);
+
+    SNAPSHOT_HEADER header;
+    size_t column_count = parser->container.column_count;
+    SNAPSHOT_COLUMN* columns = calloc(column_count > 0 ? column_count : 1, sizeof(SNAPSHOT_COLUMN));
+    if (!columns || _snapshot_layout(parser, &header, columns))
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR SNAPSHOT");
+            free(columns);
+            return 1;
+        }
 
-    if (target_file == NULL || !parser)
+    P_PFILE target_file = fopen(filename, "wb");
+    if (target_file == NULL)
         {
             PARSER_LOG_CRITICAL("FAILED TO OPEN FILE FOR WRITING: %s", filename);
+            free(columns);
             return 1;
         }
 
-    size_t line_count = parser->container.line_count;
-    char splitter = parser->settings.splitter;
+    setvbuf(target_file, NULL, _IONBF, 0);
+
+    OUTPUT_BUFFER output;
+    if (_output_init(&output, target_file, OUTPUT_BUFFER_SIZE))
+        {
+            fclose(target_file);
+            free(columns);
+            return 1;
+        }
 
-    CONTAINER_DATA** lines = parser->container.lines;
-    LINE_INFO* info = parser->container.info;
+    _snapshot_write(&parser->container, &header, columns, &output);
+    free(columns);
 
-    for (size_t i = 0; i < line_count; i++)
+    int result = _output_flush(&output);
+    _output_free(&output);
+
+    if (fclose(target_file) != 0) result = 1;
+    if (result) PARSER_LOG_CRITICAL("FAILED TO WRITE SNAPSHOT: %s", filename);
+    else PARSER_LOG_INFO("SAVED A SNAPSHOT OF %zu LINES TO %s", parser->container.line_count, filename);
+    return result;
+}
+
+int load_snapshot(PARSER* parser, const char* filename)
+{
+    _init_once();
+
+    if (!parser)
+        {
+            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR SNAPSHOT");
+            return 1;
+        }
+
+    FILE_VIEW view;
+    if (_map_file(filename, &view, 1) || view.data == NULL)
         {
-            CONTAINER_DATA* current_data = lines[i];
-            size_t token_count = info[i].token_count;
+            PARSER_LOG_CRITICAL("FAILED TO MAP SNAPSHOT: %s", filename);
+            return 1;
+        }
 
-            for (size_t j = 0; j < token_count - 1; j++)
-                {
-                    CONTAINER_DATA* data = &current_data[j];
-                    handlers[data->type].save(data, target_file, splitter);
-                }
+    // the container is built aside, a failed load leaves the parser as it was
+    const SNAPSHOT_HEADER* header = (const SNAPSHOT_HEADER*)view.data;
+    PARSER_CONTAINER container;
+    PARSER_ARENA arena;
+    _arena_init(&arena);
+    memset(&container, 0, sizeof(PARSER_CONTAINER));
 
-            // last value without the splitter symbol
-            CONTAINER_DATA* last_data = &current_data[token_count - 1];
-            handlers[last_data->type].save(last_data, target_file, '\n');
+    if (_snapshot_check(header, view.size) || _snapshot_attach(&view, &container, &arena))
+        {
+            PARSER_LOG_CRITICAL("NOT A VALID SNAPSHOT: %s", filename);
+            free(container.schema);
+            _free_container_dictionaries(&container);
+            _arena_free(&arena);
+            _unmap_file(&view);
+            return 1;
         }
 
-    fclose(target_file);
+    free(parser->container.lines);
+    free(parser->container.info);
+    free(parser->container.schema);
+    _free_container_dictionaries(&parser->container);
+    _free_indexes(parser);
+    _arena_free(&parser->arena);
+    _release_source(parser);
+    parser->follow_offset = 0;
+
+    // the columns point into the mapping, it stays until the parser is freed
+    parser->container = container;
+    parser->arena = arena;
+    parser->source = view.data;
+    parser->source_size = view.size;
+
+    parser->sorted = (int)header->sorted;
+    parser->sorted_column = (size_t)header->sorted_column;
+    parser->sort_settings.tag = COLUMN_INDEX;
+    parser->sort_settings.value.column_index = parser->sorted_column;
+    parser->sort_settings.direction = (header->sort_direction) ? DESCENDING : ASCENDING;
+    parser->sort_settings.case_sensitive = (int)header->case_sensitive;
+
+    PARSER_LOG_INFO("LOADED A SNAPSHOT OF %zu LINES FROM %s", container.line_count, filename);
     return 0;
 }
 
@@ -309,7 +1178,7 @@ int print_all_data(PARSER* parser)
 
 int print_data(PARSER* parser, size_t max_rows_to_display)
 {
-    if (!parser || parser->container.lines == NULL)
+    if (!parser || (parser->container.lines == NULL && parser->container.columns == NULL))
         {
             PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR PRINTING");
             return 1;
@@ -339,11 +1208,18 @@ int print_data(PARSER* parser, size_t max_rows_to_display)
             return 1;
         }
 
+    // only the printed rows are converted
+    for (size_t i = 0; i < head_count; i++)
+        _materialize_row(parser, i);
+    for (size_t i = line_count - tail_count; i < line_count; i++)
+        _materialize_row(parser, i);
+
     // calculate widths for the head rows
     for (size_t i = 0; i < head_count; i++)
         for (size_t j = 0; j < column_count; j++)
             {
-                char* str_val = _container_value_to_str(&parser->container.lines[i][j]);
+                CONTAINER_DATA cell = _get_cell(&parser->container, i, j);
+                char* str_val = _container_value_to_str(&cell);
                 size_t len = _count_utf8_chars(str_val);
                 if (len > col_widths[j]) col_widths[j] = len;
                 free(str_val);
@@ -354,7 +1230,8 @@ int print_data(PARSER* parser, size_t max_rows_to_display)
         for (size_t i = line_count - tail_count; i < line_count; i++)
             for (size_t j = 0; j < column_count; j++)
                 {
-                    char* str_val = _container_value_to_str(&parser->container.lines[i][j]);
+                    CONTAINER_DATA cell = _get_cell(&parser->container, i, j);
+                    char* str_val = _container_value_to_str(&cell);
                     size_t len = _count_utf8_chars(str_val);
                     if (len > col_widths[j]) col_widths[j] = len;
                     free(str_val);
@@ -389,73 +1266,449 @@ int print_data(PARSER* parser, size_t max_rows_to_display)
     return 0;
 }
 
-void free_parser(PARSER* parser)
+CONTAINER_DATA get_cell(PARSER* parser, size_t row, size_t column)
 {
-    if (!parser)
+    CONTAINER_DATA cell;
+    _set_null(&cell);
+
+    if (!parser || row >= parser->container.line_count || column >= _row_length(&parser->container, row))
         {
-            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR MEMORY RELEASING");
-            return;
+            PARSER_LOG_WARNING("CELL [%zu, %zu] IS OUT OF THE CONTAINER", row, column);
+            return cell;
         }
 
-    if (parser->container.lines && parser->container.info)
-        for (size_t i = 0; i < parser->container.line_count; i++)
-            {
-                for (size_t j = 0; j < parser->container.info[i].token_count; j++)
-                    if (parser->container.lines[i][j].type == STRING_TYPE)
-                        free(parser->container.lines[i][j].value.string);
-                free(parser->container.lines[i]);
-            }
-
-    free(parser->container.lines);
-    free(parser->container.info);
-    free(parser);
-
-    PARSER_LOG_INFO("THE MEMORY OF THE PARSER HAS BEEN FREED SUCCESSFULLY");
+    if (parser->container.layout == ROW_LAYOUT)
+        _materialize_cell(&parser->arena, &parser->container.lines[row][column]);
+    return _get_cell(&parser->container, row, column);
 }
 
-PARSER_SETTINGS create_parser_settings()
+const PARSER_COLUMN* get_column(PARSER* parser, size_t column)
 {
-    if (system_initialized ^ 1) _init_parser();
-    return DEFAULT_PARSER_SETTINGS;
-}
+    if (!parser || parser->container.layout != COLUMNAR_LAYOUT || column >= parser->container.column_count)
+        {
+            PARSER_LOG_WARNING("COLUMN %zu IS NOT AVAILABLE (THE CONTAINER MUST USE COLUMNAR LAYOUT)", column);
+            return NULL;
+        }
 
-void change_default_settings(PARSER_SETTINGS settings)
-{
-    parser_settings_initialized = 1;
-    DEFAULT_PARSER_SETTINGS = settings;
+    return &parser->container.columns[column];
 }
 
-PARSER_SORT_SETTINGS create_parser_sort_settings()
+int build_index(PARSER* parser, size_t column)
 {
-    if (parser_sort_settings_initialized ^ 1) _init_parser();
-    return DEFAULT_PARSER_SORT_SETTINGS;
-}
+    if (!parser || (parser->container.lines == NULL && parser->container.columns == NULL) || column >= parser->container.column_count)
+        {
+            PARSER_LOG_CRITICAL("CAN'T BUILD AN INDEX ON COLUMN %zu", column);
+            return 1;
+        }
 
-void change_default_sort_settings(PARSER_SORT_SETTINGS settings)
-{
-    parser_sort_settings_initialized = 1;
-    DEFAULT_PARSER_SORT_SETTINGS = settings;
-}
+    PARSER_CONTAINER* container = &parser->container;
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = container->line_count - start_index;
 
-/* =============== PRIVATE ================ */
-// Initialization functions
-static void _init_parser()
-{
-    PARSER_LOG_INFO("Initializing the system.");
-    if (parser_settings_initialized ^ 1)
+    // the keys are the typed values, so lazy cells are converted first
+    _materialize_column(parser, column);
+
+    PARSER_INDEX* index = calloc(1, sizeof(PARSER_INDEX));
+    size_t slot_count = MIN_CAPACITY;
+    while (slot_count < data_count * 2) INCREASE_CAP(&slot_count);
+    if (index)
         {
-            change_default_settings(
-                _create_default_parser_settings());
+            index->column = column;
+            index->slot_count = slot_count;
+            index->slots = calloc(slot_count, sizeof(INDEX_SLOT));
+            index->rows = malloc((data_count > 0 ? data_count : 1) * sizeof(size_t));
         }
-    if (parser_sort_settings_initialized ^ 1)
+    if (!index || !index->slots || !index->rows)
         {
-            change_default_sort_settings(
-                _create_default_parser_sort_settings());
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE INDEX");
+            _free_index(index);
+            return 1;
+        }
+
+    // first pass: counting the rows of every key
+    for (size_t row = start_index; row < container->line_count; row++)
+        {
+            CONTAINER_DATA cell = _get_cell(container, row, column);
+            uint64_t hash = _hash_cell(&cell);
+            INDEX_SLOT* slot = _index_find(index, container, &cell, hash);
+            if (slot->count == 0)
+                {
+                    slot->hash = hash;
+                    slot->key_row = row;
+                }
+            slot->count++;
+        }
+
+    // every key gets its range of rows
+    size_t offset = 0;
+    for (size_t i = 0; i < slot_count; i++)
+        {
+            INDEX_SLOT* slot = &index->slots[i];
+            slot->first = offset;
+            offset += slot->count;
+            slot->count = 0;
+        }
+
+    // second pass: filling the ranges, rows come in ascending order
+    for (size_t row = start_index; row < container->line_count; row++)
+        {
+            CONTAINER_DATA cell = _get_cell(container, row, column);
+            INDEX_SLOT* slot = _index_find(index, container, &cell, _hash_cell(&cell));
+            index->rows[slot->first + slot->count++] = row;
+        }
+
+    // an older index on the same column is replaced
+    PARSER_INDEX** link = &parser->indexes;
+    while (*link && (*link)->column != column) link = &(*link)->next;
+    if (*link)
+        {
+            PARSER_INDEX* old = *link;
+            *link = old->next;
+            _free_index(old);
+        }
+    index->next = parser->indexes;
+    parser->indexes = index;
+
+    PARSER_LOG_INFO("BUILT AN INDEX ON COLUMN %zu [%zu ROWS]", column, data_count);
+    return 0;
+}
+
+const size_t* lookup_index(PARSER* parser, size_t column, CONTAINER_DATA value, size_t* count)
+{
+    if (count) *count = 0;
+    if (!parser || !count)
+        {
+            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR LOOKUP");
+            return NULL;
+        }
+
+    const PARSER_INDEX* index = parser->indexes;
+    while (index && index->column != column) index = index->next;
+    if (!index)
+        {
+            PARSER_LOG_WARNING("NO INDEX ON COLUMN %zu, CALL build_index FIRST", column);
+            return NULL;
+        }
+
+    const INDEX_SLOT* slot = _index_find(index, &parser->container, &value, _hash_cell(&value));
+    if (slot->count == 0)
+        return NULL;
+
+    *count = slot->count;
+    return index->rows + slot->first;
+}
+
+int find_lower_bound(PARSER* parser, CONTAINER_DATA value, size_t* row)
+{
+    return _search_bound(parser, &value, 0, row);
+}
+
+int find_upper_bound(PARSER* parser, CONTAINER_DATA value, size_t* row)
+{
+    return _search_bound(parser, &value, 1, row);
+}
+
+int find_range(PARSER* parser, CONTAINER_DATA from, CONTAINER_DATA to, PARSER_ROW_RANGE* range)
+{
+    if (!range)
+        {
+            PARSER_LOG_CRITICAL("NO RANGE TO FILL");
+            return 1;
+        }
+
+    size_t first, last;
+    if (_search_bound(parser, &from, 0, &first) || _search_bound(parser, &to, 1, &last))
+        return 1;
+
+    range->first = first;
+    range->count = (last > first) ? last - first : 0;
+    return 0;
+}
+
+P_PARSER aggregate(PARSER* parser, const size_t* group_columns, size_t group_count, const PARSER_AGGREGATION* aggregations, size_t aggregation_count)
+{
+    if (!parser || (parser->container.lines == NULL && parser->container.columns == NULL) || (group_count > 0 && !group_columns)
+        || (aggregation_count > 0 && !aggregations) || group_count + aggregation_count == 0)
+        {
+            PARSER_LOG_CRITICAL("INVALID AGGREGATION SETTINGS");
+            return NULL;
+        }
+
+    PARSER_CONTAINER* container = &parser->container;
+    for (size_t i = 0; i < group_count; i++)
+        if (group_columns[i] >= container->column_count)
+            {
+                PARSER_LOG_CRITICAL("GROUP COLUMN %zu EXCEEDS NUMBER OF COLUMNS [MAX: %zu]", group_columns[i], container->column_count);
+                return NULL;
+            }
+    for (size_t i = 0; i < aggregation_count; i++)
+        if (aggregations[i].column >= container->column_count || (unsigned)aggregations[i].function > AGGREGATE_MEAN)
+            {
+                PARSER_LOG_CRITICAL("INVALID AGGREGATION %zu [COLUMN: %zu, FUNCTION: %d]", i, aggregations[i].column, (int)aggregations[i].function);
+                return NULL;
+            }
+
+    // lazy cells are converted once here, the threads only read typed cells
+    for (size_t i = 0; i < group_count; i++)
+        _materialize_column(parser, group_columns[i]);
+    for (size_t i = 0; i < aggregation_count; i++)
+        _materialize_column(parser, aggregations[i].column);
+
+    GROUP_TABLE table;
+    if (_group_table_init(&table, container, group_columns, group_count, aggregations, aggregation_count))
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR AGGREGATION");
+            return NULL;
+        }
+
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = container->line_count - start_index;
+    size_t thread_count = _resolve_thread_count(parser->settings.thread_count);
+    size_t max_threads = data_count / PARALLEL_MIN_AGGREGATE_SIZE;
+    if (thread_count > max_threads) thread_count = max_threads;
+
+    int result;
+    if (thread_count > 1)
+        result = _aggregate_parallel(&table, start_index, container->line_count, thread_count);
+    else
+        result = _aggregate_rows(&table, start_index, container->line_count);
+
+    // without group columns there is always one row, even for no data
+    size_t group;
+    if (result == 0 && group_count == 0 && table.group_count == 0)
+        result = _group_find(&table, 0, _group_hash(&table, 0), &group);
+
+    P_PARSER output = (result == 0) ? create_parser() : NULL;
+    if (output)
+        {
+            output->settings = parser->settings;
+            if (_fill_aggregate(output, parser, &table))
+                {
+                    free_parser(output);
+                    output = NULL;
+                }
+        }
+    _group_table_free(&table);
+
+    if (!output)
+        {
+            PARSER_LOG_CRITICAL("AGGREGATION FAILED");
+            return NULL;
+        }
+
+    PARSER_LOG_INFO("AGGREGATED %zu LINES INTO %zu GROUPS", data_count, output->container.line_count - output->container.header_included);
+    return output;
+}
+
+void reset_stats(PARSER* parser)
+{
+    if (parser) memset(&parser->stats, 0, sizeof(PARSER_STATS));
+}
+
+void free_parser(PARSER* parser)
+{
+    if (!parser)
+        {
+            PARSER_LOG_CRITICAL("INVALID PARSER STATE FOR MEMORY RELEASING");
+            return;
+        }
+
+    // rows and strings live in the arena, so only its blocks have to be released
+    free(parser->container.lines);
+    free(parser->container.info);
+    free(parser->container.schema);
+    _free_container_dictionaries(&parser->container);
+    _free_indexes(parser);
+    _arena_free(&parser->arena);
+    _release_source(parser);
+    free(parser);
+
+    PARSER_LOG_INFO("THE MEMORY OF THE PARSER HAS BEEN FREED SUCCESSFULLY");
+}
+
+PARSER_SETTINGS create_parser_settings()
+{
+    _init_once();
+    DEFAULTS_LOCK();
+    PARSER_SETTINGS settings = DEFAULT_PARSER_SETTINGS;
+    DEFAULTS_UNLOCK();
+    return settings;
+}
+
+void change_default_settings(PARSER_SETTINGS settings)
+{
+    DEFAULTS_LOCK();
+    parser_settings_initialized = 1;
+    DEFAULT_PARSER_SETTINGS = settings;
+    DEFAULTS_UNLOCK();
+}
+
+PARSER_SORT_SETTINGS create_parser_sort_settings()
+{
+    _init_once();
+    DEFAULTS_LOCK();
+    PARSER_SORT_SETTINGS settings = DEFAULT_PARSER_SORT_SETTINGS;
+    DEFAULTS_UNLOCK();
+    return settings;
+}
+
+void change_default_sort_settings(PARSER_SORT_SETTINGS settings)
+{
+    DEFAULTS_LOCK();
+    parser_sort_settings_initialized = 1;
+    DEFAULT_PARSER_SORT_SETTINGS = settings;
+    DEFAULTS_UNLOCK();
+}
+
+void set_log_level(int level)
+{
+    if (level < LOGLEVEL_CRITICAL || level > LOGLEVEL_NONE)
+        {
+            PARSER_LOG_WARNING("UNKNOWN LOG LEVEL %d", level);
+            return;
+        }
+    ATOMIC_STORE_RELAXED(&parser_log_level, level == LOGLEVEL_NONE ? -1 : level);
+}
+
+int get_log_level()
+{
+    int level = __parser_log_level();
+    return level < 0 ? LOGLEVEL_NONE : level;
+}
+
+int enable_log_trace(size_t events_per_thread)
+{
+#ifndef FILEPARSER_NO_THREADS
+    pthread_once(&trace_once, _trace_create_key);
+    if (trace_key_failed)
+        {
+            PARSER_LOG_CRITICAL("FAILED TO CREATE THE TRACE KEY");
+            return 1;
+        }
+#endif
+    if (events_per_thread && !trace_start) trace_start = _trace_clock();
+    ATOMIC_STORE(&trace_capacity, events_per_thread);
+    return 0;
+}
+
+int dump_log_trace(FILE* file)
+{
+    if (!file)
+        {
+            PARSER_LOG_CRITICAL("INVALID FILE FOR THE TRACE DUMP");
+            return 1;
+        }
+
+#ifndef FILEPARSER_NO_THREADS
+    pthread_mutex_lock(&trace_dump_lock);
+#endif
+    // rings only ever get added to the front, so whatever is seen here stays valid
+    TRACE_RING* rings = ATOMIC_LOAD(&trace_rings);
+    size_t capacity = 0;
+    for (TRACE_RING* ring = rings; ring; ring = ring->next)
+        capacity += ring->capacity;
+
+    TRACE_EVENT* events = capacity ? malloc(capacity * sizeof(TRACE_EVENT)) : NULL;
+    if (capacity && !events)
+        {
+#ifndef FILEPARSER_NO_THREADS
+            pthread_mutex_unlock(&trace_dump_lock);
+#endif
+            PARSER_LOG_CRITICAL("FAILED TO ALLOCATE THE TRACE DUMP");
+            return 1;
+        }
+
+    size_t count = 0, lost = 0;
+    for (TRACE_RING* ring = rings; ring; ring = ring->next)
+        {
+            size_t head = ATOMIC_LOAD(&ring->head);
+            size_t first = ring->dumped;
+            if (head - first > ring->capacity)
+                {
+                    lost += head - first - ring->capacity;
+                    first = head - ring->capacity;
+                }
+            for (size_t i = first; i < head; i++)
+                {
+                    // the owner may be writing the slot right now, a copy only counts if the version didn't move
+                    const TRACE_EVENT* slot = &ring->events[i & (ring->capacity - 1)];
+                    unsigned version = ATOMIC_LOAD(&slot->version);
+                    memcpy(&events[count], slot, sizeof(TRACE_EVENT));
+                    ATOMIC_FENCE_ACQUIRE();
+                    if ((version & 1) || ATOMIC_LOAD(&slot->version) != version || events[count].index != i)
+                        {
+                            lost++;
+                            continue;
+                        }
+                    count++;
+                }
+            ring->dumped = head;
+        }
+
+    qsort(events, count, sizeof(TRACE_EVENT), _trace_compare_events);
+
+    char message[TRACE_MESSAGE_SIZE];
+    for (size_t i = 0; i < count; i++)
+        {
+            _trace_format(&events[i], message, sizeof(message));
+            fprintf(file, "[%.6f] [T%u] [%s]: %s:%s:%d: %s\n", (double)events[i].time * 1e-9, events[i].thread,
+                    loglevels[events[i].level], events[i].function, events[i].file, events[i].line, message);
+        }
+    if (lost) fprintf(file, "[TRACE]: %zu EVENTS WERE OVERWRITTEN BEFORE THEY WERE DUMPED\n", lost);
+
+    free(events);
+#ifndef FILEPARSER_NO_THREADS
+    pthread_mutex_unlock(&trace_dump_lock);
+#endif
+    return ferror(file) ? 1 : 0;
+}
+
+void __parser_log_write(int level, const char* function, const char* file, int line, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    TRACE_RING* ring = ATOMIC_LOAD(&trace_capacity) ? _trace_ring() : NULL;
+    if (ring)
+        _trace_record(ring, level, function, file, line, format, &args);
+    else
+        _log_to_stderr(level, function, file, line, format, args);
+    va_end(args);
+}
+
+/* =============== PRIVATE ================ */
+// Initialization functions
+static void _init_parser()
+{
+    PARSER_LOG_INFO("Initializing the system.");
+    // defaults changed before the first parser are kept
+    DEFAULTS_LOCK();
+    if (parser_settings_initialized ^ 1)
+        {
+            DEFAULT_PARSER_SETTINGS = _create_default_parser_settings();
+            parser_settings_initialized = 1;
+        }
+    if (parser_sort_settings_initialized ^ 1)
+        {
+            DEFAULT_PARSER_SORT_SETTINGS = _create_default_parser_sort_settings();
+            parser_sort_settings_initialized = 1;
         }
+    DEFAULTS_UNLOCK();
+
+    scan_block = _select_block_scanner();
 
     system_initialized = 1;
 }
 
+// runs _init_parser exactly once, even when the first parsers are created on several threads
+static void _init_once()
+{
+#ifdef FILEPARSER_NO_THREADS
+    if (system_initialized ^ 1) _init_parser();
+#else
+    pthread_once(&init_once, _init_parser);
+#endif
+}
+
 static PARSER_SETTINGS _create_default_parser_settings()
 {
     PARSER_SETTINGS settings;
@@ -464,6 +1717,20 @@ static PARSER_SETTINGS _create_default_parser_settings()
     settings.ignore_first_line = 0;
     settings.first_line_as_header = 1;
     settings.save_memory = 0;
+    settings.use_mmap = 0;
+    settings.thread_count = 1;
+    settings.layout = ROW_LAYOUT;
+    settings.lazy_types = 0;
+    settings.schema_sample_rows = SCHEMA_SAMPLE_ROWS;
+    settings.dictionary_encoding = 0;
+    settings.projection = NULL;
+    settings.projection_names = NULL;
+    settings.projection_count = 0;
+    settings.filters = NULL;
+    settings.filter_count = 0;
+    settings.row_filter = NULL;
+    settings.row_filter_data = NULL;
+    settings.quoted_fields = 0;
     return settings;
 }
 
@@ -480,19 +1747,17 @@ static PARSER_SORT_SETTINGS _create_default_parser_sort_settings()
 // Parser functions
 static int _parse_file(PARSER* parser, P_PFILE file_to_parse)
 {
-    char buffer[BUFFER_CAPACITY];
-    size_t line_count = 0;
-    size_t column_count = 0;
-    size_t capacity = MIN_CAPACITY;
-
-    CONTAINER_DATA** lines = malloc(capacity * sizeof(CONTAINER_DATA*));
-    LINE_INFO* info = malloc(capacity * sizeof(LINE_INFO));
+    STATS_START(parse_start);
+    PARSE_STATE state;
+    if (_init_parse_state(&state))
+        return 1;
 
-    if (!lines || !info)
+    size_t buffer_capacity = BUFFER_CAPACITY;
+    char* buffer = malloc(buffer_capacity);
+    if (!buffer)
         {
-            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING PARSING");
-            free(lines);
-            free(info);
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR LINE BUFFER");
+            _free_parse_state(&state);
             return 1;
         }
 
@@ -500,468 +1765,5288 @@ static int _parse_file(PARSER* parser, P_PFILE file_to_parse)
     const int ignore_first_line = parser->settings.ignore_first_line;
     const int first_line_as_header = (ignore_first_line) ? 0 : parser->settings.first_line_as_header;
 
-    // handling the first line here ( outside the loop ) to avoid repeated checks
-    if (fgets(buffer, sizeof(buffer), file_to_parse))
+    state.lazy = _lazy_mode(parser, 1);
+    state.quoted = parser->settings.quoted_fields;
+    state.sample_size = (state.lazy) ? 0 : parser->settings.schema_sample_rows;
+    state.encode_strings = (state.lazy) ? 0 : parser->settings.dictionary_encoding;
+    state.filter.filters = parser->settings.filters;
+    state.filter.filter_count = (parser->settings.filters) ? parser->settings.filter_count : 0;
+    state.filter.callback = parser->settings.row_filter;
+    state.filter.data = parser->settings.row_filter_data;
+
+    LINE_SCANNER scanner;
+    if (_scanner_init(&scanner, splitter, state.quoted))
+        {
+            free(buffer);
+            _free_parse_state(&state);
+            return 1;
+        }
+
+    const char* line;
+    size_t length;
+    int is_first_line = 1;
+    int result = 0;
+
+    while (result == 0 && _read_line(file_to_parse, &buffer, &buffer_capacity, &length, &state) == 0)
         {
-            if (!ignore_first_line)
+            _scanner_reset(&scanner, buffer, buffer + length);
+            if (_scanner_next_line(&scanner, &line, &length))
                 {
-                    if (first_line_as_header)
-                        info[line_count].is_header = 1;
-                    else
-                        info[line_count].is_header = 0;
+                    result = 1;
+                    break;
+                }
 
-                    size_t token_count;
-                    PARSER_LOG_DEBUG("PARSING LINE [%zu]: %s", line_count, buffer);
-                    lines[line_count] = _parse_line(buffer, splitter, &token_count);
-                    info[line_count++].token_count = token_count;
+            if (is_first_line)
+                {
+                    is_first_line = 0;
+                    result = _resolve_projection(&parser->settings, &state, &scanner, line, length);
+                    if (ignore_first_line || result) continue;
+                    result = _push_line(&state, &scanner, line, length, first_line_as_header);
                 }
+            else result = _push_line(&state, &scanner, line, length, 0);
         }
 
-    // process remaining lines
-    while (fgets(buffer, sizeof(buffer), file_to_parse))
+    _scanner_free(&scanner);
+    free(buffer);
+
+    if (result)
         {
-            if (line_count >= capacity)
-                {
-                    INCREASE_CAP(&capacity);
-                    lines = realloc(lines, capacity * sizeof(CONTAINER_DATA*));
-                    info = realloc(info, capacity * sizeof(LINE_INFO));
+            _free_parse_state(&state);
+            return 1;
+        }
 
-                    if (!lines || !info)
-                        {
-                            free(lines);
-                            free(info);
-                            return 1;
-                        }
-                }
+#ifdef FILEPARSER_STATS
+    _stats_add_parse(parser, &state, &parse_start);
+#endif
+    return _finish_parse(parser, &state, first_line_as_header);
+}
+
+static int _parse_buffer(PARSER* parser, const char* data, size_t size)
+{
+    STATS_START(parse_start);
+    PARSE_STATE state;
+    if (_init_parse_state(&state))
+        return 1;
+    STATS_ADD(state.stats.bytes_read, size);
 
-            PARSER_LOG_DEBUG("PARSING LINE [%zu]: %s", line_count, buffer);
-            size_t token_count;
+    const char splitter = parser->settings.splitter;
+    const int ignore_first_line = parser->settings.ignore_first_line;
+    const int first_line_as_header = (ignore_first_line) ? 0 : parser->settings.first_line_as_header;
 
-            lines[line_count] = _parse_line(buffer, splitter, &token_count);
-            info[line_count].token_count = token_count;
-            info[line_count].is_header = 0;
+    state.lazy = _lazy_mode(parser, 0);
+    state.quoted = parser->settings.quoted_fields;
+    state.sample_size = (state.lazy) ? 0 : parser->settings.schema_sample_rows;
+    state.encode_strings = (state.lazy) ? 0 : parser->settings.dictionary_encoding;
+    state.filter.filters = parser->settings.filters;
+    state.filter.filter_count = (parser->settings.filters) ? parser->settings.filter_count : 0;
+    state.filter.callback = parser->settings.row_filter;
+    state.filter.data = parser->settings.row_filter_data;
+
+    LINE_SCANNER scanner;
+    if (_scanner_init(&scanner, splitter, state.quoted))
+        {
+            _free_parse_state(&state);
+            return 1;
+        }
+    _scanner_reset(&scanner, data, data + size);
 
-            if (info[line_count].token_count > column_count) column_count = info[line_count].token_count;
+    const char* line;
+    size_t length;
+    int result = 0;
 
-            line_count++;
+    // handling the first line here ( outside the loop ) to avoid repeated checks
+    if (_scanner_next_line(&scanner, &line, &length) == 0)
+        {
+            result = _resolve_projection(&parser->settings, &state, &scanner, line, length);
+            if (result == 0 && !ignore_first_line)
+                result = _push_line(&state, &scanner, line, length, first_line_as_header);
         }
 
-    // checking if we can free some memory
-    if (parser->settings.save_memory && line_count < capacity)
+    // the schema sample is always parsed here, so every thread gets the same schema
+    while (result == 0 && state.sample_size > 0 && _scanner_next_line(&scanner, &line, &length) == 0)
+        result = _push_line(&state, &scanner, line, length, 0);
+
+    if (result == 0)
+        result = _parse_remaining(parser, &state, &scanner);
+
+    _scanner_free(&scanner);
+
+    if (result)
         {
-            lines = realloc(lines, line_count * sizeof(CONTAINER_DATA*));
-            info = realloc(info, line_count * sizeof(LINE_INFO));
+            _free_parse_state(&state);
+            return 1;
+        }
+
+#ifdef FILEPARSER_STATS
+    _stats_add_parse(parser, &state, &parse_start);
+#endif
+    return _finish_parse(parser, &state, first_line_as_header);
+}
+
+static int _parse_remaining(PARSER* parser, PARSE_STATE* state, LINE_SCANNER* scanner)
+{
+    // the rest of the scanned range is split between threads when it's big enough
+    size_t thread_count = _resolve_thread_count(parser->settings.thread_count);
+    size_t max_threads = (size_t)(scanner->end - scanner->line_start) / PARALLEL_MIN_CHUNK_SIZE;
+    if (thread_count > max_threads) thread_count = max_threads;
+
+    if (thread_count > 1)
+        return _parse_range_parallel(state, scanner->line_start, scanner->end, parser->settings.splitter, thread_count);
+
+    const char* line;
+    size_t length;
+    int status;
+    while ((status = _scanner_next_line(scanner, &line, &length)) == 0)
+        if (_push_line(state, scanner, line, length, 0))
+            break;
+    return (status == 1) ? 0 : 1;
+}
+
+static int _parse_appended(PARSER* parser, const char* data, size_t begin, size_t end)
+{
+    // lines after begin are parsed like the ones after the schema sample and joined to the container
+    STATS_START(parse_start);
+    PARSE_STATE state;
+    if (_init_parse_state(&state))
+        return 1;
+    STATS_ADD(state.stats.bytes_read, end - begin);
+
+    PARSER_CONTAINER* container = &parser->container;
+    state.lazy = _lazy_mode(parser, 1); // the file is unmapped after the refresh, so lazy text is copied
+    state.quoted = parser->settings.quoted_fields;
+    state.schema = container->schema;
+    state.schema_size = (container->schema) ? container->column_count : 0;
+    state.filter.filters = parser->settings.filters;
+    state.filter.filter_count = (parser->settings.filters) ? parser->settings.filter_count : 0;
+    state.filter.callback = parser->settings.row_filter;
+    state.filter.data = parser->settings.row_filter_data;
+
+    LINE_SCANNER scanner;
+    if (_scanner_init(&scanner, parser->settings.splitter, state.quoted))
+        {
+            _free_parse_state(&state);
+            return 1;
+        }
+
+    // projected names are looked up in the first line of the file again
+    const char* line;
+    size_t length;
+    int result = 0;
+    _scanner_reset(&scanner, data, data + begin);
+    if (_scanner_next_line(&scanner, &line, &length) == 0)
+        result = _resolve_projection(&parser->settings, &state, &scanner, line, length);
+
+    if (result == 0)
+        {
+            _scanner_reset(&scanner, data + begin, data + end);
+            result = _parse_remaining(parser, &state, &scanner);
+        }
+    _scanner_free(&scanner);
+
+#ifdef FILEPARSER_STATS
+    if (result == 0) _stats_add_parse(parser, &state, &parse_start);
+#endif
+    if (result == 0)
+        result = _finish_append(parser, &state);
+    _free_parse_state(&state);
+    return result;
+}
+
+static int _finish_append(PARSER* parser, PARSE_STATE* state)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    size_t old_count = container->line_count;
+    size_t line_count = old_count + state->line_count;
+    if (state->line_count == 0)
+        return 0;
+
+    CONTAINER_DATA** lines = realloc(container->lines, line_count * sizeof(CONTAINER_DATA*));
+    if (lines) container->lines = lines;
+    LINE_INFO* info = realloc(container->info, line_count * sizeof(LINE_INFO));
+    if (info) container->info = info;
+    STATS_ADD(parser->stats.reallocs, 2);
+    if (!lines || !info)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE NEW LINES");
+            return 1;
         }
 
-    // setting up our parser attributes
-    parser->container.lines = lines;
-    parser->container.info = info;
-    parser->container.column_count = column_count;
-    parser->container.line_count = line_count;
-    parser->container.header_included = first_line_as_header;
+    // the rows move to the parser arena, the state only keeps its (now empty) arrays
+    memcpy(container->lines + old_count, state->lines, state->line_count * sizeof(CONTAINER_DATA*));
+    memcpy(container->info + old_count, state->info, state->line_count * sizeof(LINE_INFO));
+    _arena_merge(&parser->arena, &state->arena);
+    container->line_count = line_count;
+
+    // wider lines add columns: the header gets names for them, the schema and older lines NULLs
+    STATS_START(fixing);
+    size_t old_columns = container->column_count;
+    if (state->column_count > old_columns)
+        {
+            container->column_count = state->column_count;
+            if (container->schema)
+                {
+                    PARSER_SCHEMA_COLUMN* schema = realloc(container->schema, container->column_count * sizeof(PARSER_SCHEMA_COLUMN));
+                    if (!schema)
+                        {
+                            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR THE SCHEMA, DROPPING IT");
+                            free(container->schema);
+                        }
+                    for (size_t j = old_columns; schema && j < container->column_count; j++)
+                        {
+                            schema[j].type = NULL_TYPE;
+                            schema[j].nullable = 1;
+                        }
+                    container->schema = schema;
+                }
+        }
+    if ((container->column_count > old_columns && _check_and_fix_header(parser))
+            || _check_and_fix_parsed_data(parser, (container->column_count > old_columns) ? 0 : old_count))
+        {
+            // the rows that were widened already are only longer than needed, the new ones are dropped
+            container->line_count = old_count;
+            container->column_count = old_columns;
+            return 1;
+        }
+    STATS_STOP(parser->stats.fixing, fixing);
+
+    // every key keeps its rows together in an index, so new rows mean building it again
+    size_t index_count;
+    size_t* index_columns = _index_columns(parser, &index_count);
+    _build_indexes(parser, index_columns, index_count);
+    free(index_columns);
+
+    parser->sorted = 0;
+    PARSER_LOG_INFO("APPENDED %zu LINES", state->line_count);
+    return 0;
+}
+
+static size_t* _index_columns(const PARSER* parser, size_t* count)
+{
+    // columns of the indexes in the order they were built (NULL if there are none)
+    *count = 0;
+    for (PARSER_INDEX* index = parser->indexes; index; index = index->next) (*count)++;
+    if (*count == 0)
+        return NULL;
+
+    size_t* columns = malloc(*count * sizeof(size_t));
+    if (!columns)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED, THE INDEXES WON'T BE REBUILT");
+            *count = 0;
+            return NULL;
+        }
+
+    size_t i = *count;
+    for (PARSER_INDEX* index = parser->indexes; index; index = index->next) columns[--i] = index->column;
+    return columns;
+}
+
+static void _build_indexes(PARSER* parser, const size_t* columns, size_t count)
+{
+    _free_indexes(parser);
+    for (size_t i = 0; i < count; i++)
+        if (build_index(parser, columns[i]))
+            PARSER_LOG_WARNING("FAILED TO REBUILD THE INDEX ON COLUMN %zu, DROPPING IT", columns[i]);
+}
+
+static int _parse_range(PARSE_STATE* state, const char* begin, const char* end, char splitter)
+{
+    LINE_SCANNER scanner;
+    if (_scanner_init(&scanner, splitter, state->quoted))
+        return 1;
+    _scanner_reset(&scanner, begin, end);
+
+    // every line is handed over in place together with its '\n', nothing is copied
+    const char* line;
+    size_t length;
+    int status;
+    while ((status = _scanner_next_line(&scanner, &line, &length)) == 0)
+        if (_push_line(state, &scanner, line, length, 0))
+            break;
+
+    _scanner_free(&scanner);
+    return (status == 1) ? 0 : 1;
+}
+
+static int _parse_range_parallel(PARSE_STATE* state, const char* begin, const char* end, char splitter, size_t thread_count)
+{
+#ifdef FILEPARSER_NO_THREADS
+    (void)thread_count;
+    return _parse_range(state, begin, end, splitter);
+#else
+    PARSE_TASK* tasks = calloc(thread_count, sizeof(PARSE_TASK));
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+    int* started = calloc(thread_count, sizeof(int));
+    if (!tasks || !threads || !started)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR PARSING THREADS, PARSING IN ONE THREAD");
+            free(tasks);
+            free(threads);
+            free(started);
+            return _parse_range(state, begin, end, splitter);
+        }
+
+    // splitting the input into byte ranges, every range starts right after a '\n'
+    size_t chunk_size = (size_t)(end - begin) / thread_count;
+    const char* chunk_begin = begin;
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            const char* chunk_end = (i == thread_count - 1) ? end : begin + chunk_size * (i + 1);
+            if (chunk_end < chunk_begin) chunk_end = chunk_begin;
+            if (state->quoted && chunk_end < end && chunk_end > chunk_begin)
+                {
+                    // a '\n' between quotes is no place to split, so the quotes since the start of the range (always outside) are counted
+                    int inside = (int)(_count_quotes(chunk_begin, chunk_end - chunk_begin) & 1);
+                    if (inside || *(chunk_end - 1) != '\n')
+                        {
+                            const char* record_end = _find_record_end(chunk_end, end, inside);
+                            chunk_end = (record_end) ? record_end : end;
+                        }
+                }
+            else if (chunk_end < end && chunk_end > begin && *(chunk_end - 1) != '\n')
+                chunk_end = _next_line_start(chunk_end, end);
+
+            tasks[i].begin = chunk_begin;
+            tasks[i].end = chunk_end;
+            tasks[i].splitter = splitter;
+            tasks[i].quoted = state->quoted;
+            tasks[i].lazy = state->lazy;
+            tasks[i].schema = state->schema;
+            tasks[i].schema_size = state->schema_size;
+            tasks[i].encode_strings = state->encode_strings;
+            tasks[i].projection = state->projection;
+            tasks[i].projection_count = state->projection_count;
+            tasks[i].filter = state->filter;
+            chunk_begin = chunk_end;
+        }
+
+    for (size_t i = 0; i < thread_count; i++)
+        started[i] = (pthread_create(&threads[i], NULL, _parse_task_run, &tasks[i]) == 0);
+
+    // a range whose thread couldn't start is parsed right here
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            if (started[i]) pthread_join(threads[i], NULL);
+            else _parse_task_run(&tasks[i]);
+        }
+
+    PARSER_LOG_INFO("PARSED %zu RANGES IN PARALLEL", thread_count);
+
+    // joining local results in order
+    int result = 0;
+    size_t total_count = state->line_count;
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            if (tasks[i].result) result = 1;
+            total_count += tasks[i].state.line_count;
+        }
+
+    if (result == 0 && total_count > state->capacity)
+        {
+            CONTAINER_DATA** new_lines = realloc(state->lines, total_count * sizeof(CONTAINER_DATA*));
+            if (new_lines) state->lines = new_lines;
+            LINE_INFO* new_info = realloc(state->info, total_count * sizeof(LINE_INFO));
+            if (new_info) state->info = new_info;
+            STATS_ADD(state->stats.reallocs, 2);
+
+            if (!new_lines || !new_info)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED WHILE JOINING PARSED RANGES");
+                    result = 1;
+                }
+            else state->capacity = total_count;
+        }
+
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            PARSE_STATE* local = &tasks[i].state;
+#ifdef FILEPARSER_STATS
+            if (local->lines) _stats_merge(&state->stats, &local->stats);
+#endif
+            if (result == 0 && _merge_dictionaries(state, local))
+                result = 1;
+
+            if (result == 0)
+                {
+                    _free_dictionaries(local);
+                    memcpy(state->lines + state->line_count, local->lines, local->line_count * sizeof(CONTAINER_DATA*));
+                    memcpy(state->info + state->line_count, local->info, local->line_count * sizeof(LINE_INFO));
+                    state->line_count += local->line_count;
+                    if (local->column_count > state->column_count) state->column_count = local->column_count;
+
+                    _arena_merge(&state->arena, &local->arena);
+                    free(local->lines);
+                    free(local->info);
+                }
+            else if (local->lines) _free_parse_state(local);
+        }
+
+    free(tasks);
+    free(threads);
+    free(started);
+    return result;
+#endif
+}
+
+#ifndef FILEPARSER_NO_THREADS
+static void* _parse_task_run(void* arg)
+{
+    PARSE_TASK* task = arg;
+
+    task->result = _init_parse_state(&task->state);
+    if (task->result)
+        {
+            task->state.lines = NULL;
+            return NULL;
+        }
+    task->state.lazy = task->lazy;
+    task->state.quoted = task->quoted;
+    task->state.schema = task->schema;
+    task->state.schema_size = task->schema_size;
+    task->state.encode_strings = task->encode_strings;
+    task->state.projection = task->projection;
+    task->state.projection_count = task->projection_count;
+    task->state.filter = task->filter;
+
+    task->result = _parse_range(&task->state, task->begin, task->end, task->splitter);
+    _free_filter_scratch(&task->state);
+    return NULL;
+}
+
+static const char* _next_line_start(const char* current, const char* end)
+{
+    const char* newline = memchr(current, '\n', end - current);
+    return (newline) ? newline + 1 : end;
+}
+#endif
+
+static const char* _find_record_end(const char* current, const char* end, int inside)
+{
+    // returns the byte after the first '\n' outside quotes, NULL if the record doesn't end before end
+    while (current < end)
+        {
+            if (inside)
+                {
+                    // a "" escape just leaves the quotes and enters them again
+                    const char* quote = memchr(current, '"', end - current);
+                    if (!quote) return NULL;
+                    current = quote + 1;
+                    inside = 0;
+                    continue;
+                }
+
+            const char* newline = memchr(current, '\n', end - current);
+            const char* quote = memchr(current, '"', ((newline) ? newline : end) - current);
+            if (!quote) return (newline) ? newline + 1 : NULL;
+            current = quote + 1;
+            inside = 1;
+        }
+    return NULL;
+}
+
+static size_t _count_quotes(const char* text, size_t length)
+{
+    size_t count = 0;
+    const char* end = text + length;
+    while ((text = memchr(text, '"', end - text)))
+        {
+            count++;
+            text++;
+        }
+    return count;
+}
+
+static size_t _resolve_thread_count(size_t thread_count)
+{
+    if (thread_count != 0)
+        return thread_count;
+
+    // 0 means "use every available core"
+#if defined(_WIN32)
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return (size_t)system_info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores > 0) ? (size_t)cores : 1;
+#else
+    return 1;
+#endif
+}
+
+static int _read_line(P_PFILE file, char** buffer, size_t* capacity, size_t* length, PARSE_STATE* state)
+{
+    size_t len = 0;
+    size_t quotes = 0, counted = 0;
+#ifdef FILEPARSER_STATS
+    // the line read for a timed line is timed too, so reading can be told apart from finding the line
+    double start = (state->stats_lines % STATS_SAMPLE_LINES == 0) ? _stats_wall() : 0;
+#endif
+
+    // reading chunk by chunk until we meet the end of the line, so long rows are never split
+    while (fgets(*buffer + len, (int)(*capacity - len), file))
+        {
+            len += strlen(*buffer + len);
+            if ((*buffer)[len - 1] == '\n' || len + 1 < *capacity)
+                {
+                    if (!state->quoted || (*buffer)[len - 1] != '\n')
+                        break;
+
+                    // a line break between quotes doesn't end the record, the next line is joined to it
+                    quotes += _count_quotes(*buffer + counted, len - counted);
+                    counted = len;
+                    if ((quotes & 1) == 0)
+                        break;
+                    if (len + 1 < *capacity)
+                        continue;
+                }
+
+            size_t new_capacity = *capacity;
+            INCREASE_CAP(&new_capacity);
+            char* new_buffer = realloc(*buffer, new_capacity);
+            if (!new_buffer)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR LINE BUFFER");
+                    return 1;
+                }
+            *buffer = new_buffer;
+            *capacity = new_capacity;
+            STATS_ADD(state->stats.reallocs, 1);
+        }
+
+#ifdef FILEPARSER_STATS
+    if (start > 0) state->stats.reading.wall += _stats_wall() - start;
+    state->stats.bytes_read += len;
+#endif
+    *length = len;
+    return (len == 0) ? 1 : 0;
+}
+
+static int _init_parse_state(PARSE_STATE* state)
+{
+    state->line_count = 0;
+    state->column_count = 0;
+    state->capacity = MIN_CAPACITY;
+    state->lazy = LAZY_OFF;
+    state->quoted = 0;
+    state->sample_start = 0;
+    state->sample_size = 0;
+    state->schema = NULL;
+    state->schema_size = 0;
+    state->inferred = NULL;
+    state->encode_strings = 0;
+    state->dictionaries = NULL;
+    state->dictionary_count = 0;
+    state->projection = NULL;
+    state->projection_count = 0;
+    state->filter.filters = NULL;
+    state->filter.filter_count = 0;
+    state->filter.callback = NULL;
+    state->filter.data = NULL;
+    state->filter_row = NULL;
+    state->filter_row_capacity = 0;
+    state->filter_text = NULL;
+    state->filter_text_capacity = 0;
+#ifdef FILEPARSER_STATS
+    memset(&state->stats, 0, sizeof(PARSER_STATS));
+    state->stats_lines = 0;
+    state->stats_mark = _stats_wall();
+#endif
+    state->lines = malloc(state->capacity * sizeof(CONTAINER_DATA*));
+    state->info = malloc(state->capacity * sizeof(LINE_INFO));
+    _arena_init(&state->arena);
+
+    if (!state->lines || !state->info)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING PARSING");
+            free(state->lines);
+            free(state->info);
+            return 1;
+        }
+
+    return 0;
+}
+
+static int _push_line(PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length, int is_header)
+{
+#ifdef FILEPARSER_STATS
+    double line_start;
+    int timed = _stats_line_start(state, &line_start);
+    int result = _store_line(state, scanner, line, length, is_header);
+    _stats_line_done(state, timed, line_start);
+    return result;
+#else
+    return _store_line(state, scanner, line, length, is_header);
+#endif
+}
+
+static int _store_line(PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length, int is_header)
+{
+    // filtered out lines are dropped before anything is allocated for them
+    if (!is_header && (state->filter.filter_count || state->filter.callback))
+        {
+            int keep;
+            if (_filter_line(state, line, length, scanner->separators, scanner->separator_count, &keep))
+                return 1;
+            if (!keep)
+                {
+                    STATS_ADD(state->stats.rows_filtered, 1);
+                    return 0;
+                }
+        }
+
+    if (state->line_count >= state->capacity)
+        {
+            size_t new_capacity = state->capacity;
+            INCREASE_CAP(&new_capacity);
+
+            CONTAINER_DATA** new_lines = realloc(state->lines, new_capacity * sizeof(CONTAINER_DATA*));
+            if (new_lines) state->lines = new_lines;
+            LINE_INFO* new_info = realloc(state->info, new_capacity * sizeof(LINE_INFO));
+            if (new_info) state->info = new_info;
+            STATS_ADD(state->stats.reallocs, 2);
+
+            if (!new_lines || !new_info)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING PARSING");
+                    return 1;
+                }
+            state->capacity = new_capacity;
+        }
+
+    PARSER_LOG_DEBUG("PARSING LINE [%zu]: %.*s", state->line_count, (int)length, line);
+
+    size_t token_count;
+    CONTAINER_DATA* tokens = _parse_line(line, length, scanner->separators, scanner->separator_count, &token_count, state, is_header, scanner->transient);
+    if (!tokens)
+        return 1;
+
+    state->lines[state->line_count] = tokens;
+    state->info[state->line_count].token_count = token_count;
+    state->info[state->line_count].is_header = is_header;
+
+    if (token_count > state->column_count) state->column_count = token_count;
+    STATS_ADD(state->stats.rows_parsed, !is_header);
+
+    state->line_count++;
+    if (is_header) state->sample_start = state->line_count;
+    else if (state->sample_size > 0 && state->line_count - state->sample_start >= state->sample_size)
+        _infer_schema(state);
+    return 0;
+}
+
+static void _free_parse_state(PARSE_STATE* state)
+{
+    free(state->lines);
+    free(state->info);
+    free(state->inferred);
+    _free_filter_scratch(state);
+    _free_dictionaries(state);
+    _arena_free(&state->arena);
+}
+
+static int _resolve_projection(const PARSER_SETTINGS* settings, PARSE_STATE* state, const LINE_SCANNER* scanner, const char* line, size_t length)
+{
+    // the kept columns are fixed before the first line is parsed, names are looked up in it
+    size_t count = settings->projection_count;
+    if (count == 0 || (!settings->projection && !settings->projection_names))
+        return 0;
+
+    size_t* projection = _arena_alloc(&state->arena, count * sizeof(size_t));
+    if (!projection)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR PROJECTION");
+            return 1;
+        }
+
+    const char* line_end = line + length;
+    for (size_t k = 0; k < count; k++)
+        {
+            if (settings->projection)
+                {
+                    projection[k] = settings->projection[k];
+                    continue;
+                }
+
+            const char* name = settings->projection_names[k];
+            size_t name_length = strlen(name);
+            size_t field;
+            for (field = 0; field <= scanner->separator_count; field++)
+                {
+                    const char* start = (field == 0) ? line : scanner->separators[field - 1] + 1;
+                    size_t field_length = ((field < scanner->separator_count) ? scanner->separators[field] : line_end) - start;
+                    _trim_span(&start, &field_length);
+                    if (scanner->quoted) _remove_enclosing_quotes(&start, &field_length);
+                    else _remove_quotes(&start, &field_length);
+                    if (field_length == name_length && strncasecmp(start, name, name_length) == 0) break;
+                }
+
+            if (field > scanner->separator_count)
+                {
+                    PARSER_LOG_CRITICAL("COULDN'T FIND THE COLUMN TO KEEP: %s", name);
+                    return 1;
+                }
+            PARSER_LOG_INFO("KEEPING %s [COLUMN: %zu]", name, field);
+            projection[k] = field;
+        }
+
+    state->projection = projection;
+    state->projection_count = count;
+    return 0;
+}
+
+static int _filter_line(PARSE_STATE* state, const char* line, size_t length, const char* const* separators, size_t separator_count, int* keep)
+{
+    // the filtered fields are only classified, a dropped line never reaches the arena
+    const ROW_FILTER* filter = &state->filter;
+    *keep = 1;
+    for (size_t k = 0; k < filter->filter_count && *keep; k++)
+        {
+            CONTAINER_DATA cell;
+            const char* text;
+            size_t text_length;
+            _filter_field(state, line, length, separators, separator_count, filter->filters[k].column, &cell, &text, &text_length);
+            *keep = _filter_match(&cell, text, text_length, &filter->filters[k]);
+        }
+
+    if (!*keep || !filter->callback)
+        return 0;
+
+    // the callback gets the whole typed line, built in scratch buffers that every line reuses
+    const char* last_start = (separator_count > 0) ? separators[separator_count - 1] + 1 : line;
+    size_t field_count = separator_count + (last_start < line + length ? 1 : 0);
+    size_t count = (state->projection) ? state->projection_count : field_count;
+    if (count > state->filter_row_capacity)
+        {
+            CONTAINER_DATA* new_row = realloc(state->filter_row, count * sizeof(CONTAINER_DATA));
+            if (!new_row)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR ROW FILTER");
+                    return 1;
+                }
+            state->filter_row = new_row;
+            state->filter_row_capacity = count;
+            STATS_ADD(state->stats.reallocs, 1);
+        }
+
+    // a projection can repeat a field, so the text of every projected field is counted
+    size_t text_size = count;
+    if (state->projection)
+        {
+            for (size_t i = 0; i < count; i++)
+                {
+                    size_t field = state->projection[i];
+                    if (field >= field_count) continue;
+                    const char* start = (field == 0) ? line : separators[field - 1] + 1;
+                    text_size += ((field < separator_count) ? separators[field] : line + length) - start;
+                }
+        }
+    else text_size += length;
+
+    // strings point into the text buffer, which can only move before they are set
+    if (text_size > state->filter_text_capacity)
+        {
+            char* new_text = realloc(state->filter_text, text_size);
+            if (!new_text)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR ROW FILTER");
+                    return 1;
+                }
+            state->filter_text = new_text;
+            state->filter_text_capacity = text_size;
+            STATS_ADD(state->stats.reallocs, 1);
+        }
+
+    size_t text_used = 0;
+    for (size_t i = 0; i < count; i++)
+        {
+            CONTAINER_DATA* cell = &state->filter_row[i];
+            const char* text;
+            size_t text_length;
+            _filter_field(state, line, length, separators, separator_count, i, cell, &text, &text_length);
+            if (cell->type == STRING_TYPE)
+                {
+                    cell->value.string = state->filter_text + text_used;
+                    memcpy(cell->value.string, text, text_length);
+                    cell->value.string[text_length] = '\0';
+                    text_used += text_length + 1;
+                }
+        }
+
+    *keep = filter->callback(state->filter_row, count, filter->data) != 0;
+    return 0;
+}
+
+static void _filter_field(const PARSE_STATE* state, const char* line, size_t length, const char* const* separators, size_t separator_count, size_t column, CONTAINER_DATA* cell, const char** text, size_t* text_length)
+{
+    const char* line_end = line + length;
+    const char* last_start = (separator_count > 0) ? separators[separator_count - 1] + 1 : line;
+    size_t field_count = separator_count + (last_start < line_end ? 1 : 0);
+    size_t field = (state->projection) ? ((column < state->projection_count) ? state->projection[column] : field_count) : column;
+
+    *text = line;
+    *text_length = 0;
+    if (field >= field_count)
+        {
+            _set_null(cell);
+            return;
+        }
+
+    *text = (field == 0) ? line : separators[field - 1] + 1;
+    *text_length = ((field < separator_count) ? separators[field] : line_end) - *text;
+    _classify_token(text, text_length, cell, state->quoted);
+}
+
+static int _filter_match(const CONTAINER_DATA* cell, const char* text, size_t length, const PARSER_FILTER* filter)
+{
+    if (filter->operation == FILTER_IS_NULL) return cell->type == NULL_TYPE;
+    if (filter->operation == FILTER_NOT_NULL) return cell->type != NULL_TYPE;
+
+    // numbers compare by value (integers as unsigned, like in sort_data), strings like strcmp
+    const CONTAINER_DATA* value = &filter->value;
+    int result;
+    if (cell->type == INTEGER_TYPE && value->type == INTEGER_TYPE)
+        result = (cell->value.integer > value->value.integer) - (cell->value.integer < value->value.integer);
+    else if ((cell->type == INTEGER_TYPE || cell->type == FLOAT_TYPE) && (value->type == INTEGER_TYPE || value->type == FLOAT_TYPE))
+        {
+            bigfloat a = (cell->type == INTEGER_TYPE) ? (bigfloat)cell->value.integer : cell->value.floating;
+            bigfloat b = (value->type == INTEGER_TYPE) ? (bigfloat)value->value.integer : value->value.floating;
+            if (a != a || b != b) return filter->operation == FILTER_NOT_EQUAL;
+            result = (a > b) - (a < b);
+        }
+    else if (cell->type == STRING_TYPE && value->type == STRING_TYPE)
+        {
+            size_t value_length = strlen(value->value.string);
+            int compared = memcmp(text, value->value.string, (length < value_length) ? length : value_length);
+            result = (compared) ? compared : (length > value_length) - (length < value_length);
+        }
+    else return filter->operation == FILTER_NOT_EQUAL; // NULLs and values of different kinds don't compare
+
+    switch (filter->operation)
+        {
+            case FILTER_EQUAL: return result == 0;
+            case FILTER_NOT_EQUAL: return result != 0;
+            case FILTER_LESS: return result < 0;
+            case FILTER_LESS_EQUAL: return result <= 0;
+            case FILTER_GREATER: return result > 0;
+            case FILTER_GREATER_EQUAL: return result >= 0;
+            default: return 0;
+        }
+}
+
+static void _free_filter_scratch(PARSE_STATE* state)
+{
+    free(state->filter_row);
+    free(state->filter_text);
+    state->filter_row = NULL;
+    state->filter_row_capacity = 0;
+    state->filter_text = NULL;
+    state->filter_text_capacity = 0;
+}
+
+static void _infer_schema(PARSE_STATE* state)
+{
+    // every sampled row is still in the state, so the sample is just a look at them
+    size_t column_count = state->column_count;
+    state->sample_size = 0;
+    if (column_count == 0)
+        return;
+
+    PARSER_SCHEMA_COLUMN* schema = malloc(column_count * sizeof(PARSER_SCHEMA_COLUMN));
+    if (!schema)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR THE SCHEMA, DETECTING EVERY CELL TYPE");
+            return;
+        }
+
+    for (size_t j = 0; j < column_count; j++)
+        {
+            DATA_TYPE type = NULL_TYPE;
+            int nullable = 0;
+            int mixed = 0;
+
+            for (size_t i = state->sample_start; i < state->line_count; i++)
+                {
+                    // short rows get NULLs later, so they count as NULLs here too
+                    DATA_TYPE cell_type = (j < state->info[i].token_count) ? state->lines[i][j].type : NULL_TYPE;
+                    if (cell_type == NULL_TYPE) nullable = 1;
+                    else if (type == NULL_TYPE) type = cell_type;
+                    else if (cell_type != type) mixed = 1;
+                }
+
+            schema[j].type = (mixed) ? NULL_TYPE : type;
+            schema[j].nullable = nullable;
+        }
+
+    PARSER_LOG_INFO("INFERRED THE SCHEMA OF %zu COLUMNS FROM %zu ROWS", column_count, state->line_count - state->sample_start);
+    state->inferred = schema;
+    state->schema = schema;
+    state->schema_size = column_count;
+}
+
+static void _finish_schema(PARSER* parser, PARSE_STATE* state)
+{
+    // files shorter than the sample are inferred from what there is
+    if (state->sample_size > 0) _infer_schema(state);
+
+    free(parser->container.schema);
+    parser->container.schema = NULL;
+
+    PARSER_SCHEMA_COLUMN* schema = state->inferred;
+    state->inferred = NULL;
+    if (!schema)
+        return;
+
+    // rows after the sample can be wider, their extra columns are NULL in every sampled row
+    size_t column_count = state->column_count;
+    if (column_count > state->schema_size)
+        {
+            PARSER_SCHEMA_COLUMN* new_schema = realloc(schema, column_count * sizeof(PARSER_SCHEMA_COLUMN));
+            if (!new_schema)
+                {
+                    PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR THE SCHEMA");
+                    free(schema);
+                    return;
+                }
+            schema = new_schema;
+            for (size_t j = state->schema_size; j < column_count; j++)
+                {
+                    schema[j].type = NULL_TYPE;
+                    schema[j].nullable = 1;
+                }
+        }
+
+    parser->container.schema = schema;
+}
+
+static int _grow_dictionaries(PARSE_STATE* state, size_t count)
+{
+    STRING_TABLE* dictionaries = realloc(state->dictionaries, count * sizeof(STRING_TABLE));
+    if (!dictionaries)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR DICTIONARIES");
+            return 1;
+        }
+
+    memset(dictionaries + state->dictionary_count, 0, (count - state->dictionary_count) * sizeof(STRING_TABLE));
+    state->dictionaries = dictionaries;
+    STATS_ADD(state->stats.reallocs, 1);
+    state->dictionary_count = count;
+    return 0;
+}
+
+#ifndef FILEPARSER_NO_THREADS
+static int _merge_dictionaries(PARSE_STATE* state, PARSE_STATE* local)
+{
+    // codes of a range point into its own tables, so its cells are moved to the codes of the joined tables
+    if (local->dictionary_count > state->dictionary_count && _grow_dictionaries(state, local->dictionary_count))
+        return 1;
+
+    for (size_t j = 0; j < local->dictionary_count; j++)
+        {
+            STRING_TABLE* table = &state->dictionaries[j];
+            STRING_TABLE* local_table = &local->dictionaries[j];
+            if (table->disabled || local_table->disabled)
+                {
+                    _string_table_disable(table);
+                    continue;
+                }
+            if (local_table->count == 0) continue;
+
+            unsigned* remap = malloc(local_table->count * sizeof(unsigned));
+            int failed = (remap == NULL);
+
+            // the strings stay where they are, the arena of the range is joined too
+            for (size_t code = 0; code < local_table->count && !failed; code++)
+                failed = _string_table_add(table, local_table->values[code], strlen(local_table->values[code]),
+                                           local_table->hashes[code], NULL, &remap[code]);
+
+            if (failed)
+                {
+                    free(remap);
+                    _string_table_disable(table);
+                    continue;
+                }
+
+            for (size_t i = 0; i < local->line_count; i++)
+                {
+                    if (j >= local->info[i].token_count || local->info[i].is_header) continue;
+                    CONTAINER_DATA* cell = &local->lines[i][j];
+                    if (cell->type != STRING_TYPE) continue;
+
+                    unsigned code = remap[cell->value.coded.code];
+                    cell->value.coded.string = table->values[code];
+                    cell->value.coded.code = code;
+                }
+            free(remap);
+        }
+
+    return 0;
+}
+#endif
+
+static void _free_dictionaries(PARSE_STATE* state)
+{
+    for (size_t j = 0; j < state->dictionary_count; j++)
+        _string_table_disable(&state->dictionaries[j]);
+
+    free(state->dictionaries);
+    state->dictionaries = NULL;
+    state->dictionary_count = 0;
+}
+
+static void _finish_dictionaries(PARSER* parser, PARSE_STATE* state)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    if (!state->encode_strings || container->column_count == 0)
+        {
+            _free_dictionaries(state);
+            return;
+        }
+
+    PARSER_DICTIONARY* dictionaries = calloc(container->column_count, sizeof(PARSER_DICTIONARY));
+    if (!dictionaries)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR DICTIONARIES, STRINGS STAY UNENCODED");
+            _free_dictionaries(state);
+            return;
+        }
+
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t encoded = 0;
+
+    for (size_t j = 0; j < state->dictionary_count && j < container->column_count; j++)
+        {
+            STRING_TABLE* table = &state->dictionaries[j];
+            if (table->disabled || table->count == 0) continue;
+
+            // sorting the distinct strings once, afterwards codes compare like the strings themselves
+            size_t count = table->count;
+            PARSER_DICTIONARY* dictionary = &dictionaries[j];
+            char** sorted = malloc(count * sizeof(char*));
+            unsigned* remap = malloc(count * sizeof(unsigned));
+            dictionary->values = malloc(count * sizeof(char*));
+            dictionary->folded = malloc(count * sizeof(unsigned));
+            if (!sorted || !remap || !dictionary->values || !dictionary->folded)
+                {
+                    PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR THE DICTIONARY OF COLUMN %zu", j);
+                    free(sorted);
+                    free(remap);
+                    free(dictionary->values);
+                    free(dictionary->folded);
+                    dictionary->values = NULL;
+                    dictionary->folded = NULL;
+                    continue;
+                }
+
+            memcpy(sorted, table->values, count * sizeof(char*));
+            qsort(sorted, count, sizeof(char*), _compare_dictionary_values);
+            memcpy(dictionary->values, sorted, count * sizeof(char*));
+
+            // codes of the table are found through the (still valid) hash slots
+            for (size_t code = 0; code < count; code++)
+                {
+                    unsigned old_code;
+                    _string_table_add(table, sorted[code], strlen(sorted[code]), _hash_string(sorted[code], strlen(sorted[code])), NULL, &old_code);
+                    remap[old_code] = (unsigned)code;
+                }
+
+            // case insensitive ranks, the order of strings that only differ in case doesn't matter
+            qsort(sorted, count, sizeof(char*), _compare_dictionary_values_nocase);
+            unsigned rank = 0;
+            for (size_t i = 0; i < count; i++)
+                {
+                    if (i > 0 && strcasecmp(sorted[i - 1], sorted[i]) != 0) rank++;
+                    unsigned old_code;
+                    _string_table_add(table, sorted[i], strlen(sorted[i]), _hash_string(sorted[i], strlen(sorted[i])), NULL, &old_code);
+                    dictionary->folded[remap[old_code]] = rank;
+                }
+
+            for (size_t i = start_index; i < container->line_count; i++)
+                {
+                    if (j >= container->info[i].token_count) continue;
+                    CONTAINER_DATA* cell = &container->lines[i][j];
+                    if (cell->type == STRING_TYPE) cell->value.coded.code = remap[cell->value.coded.code];
+                }
+
+            dictionary->count = count;
+            encoded++;
+            free(sorted);
+            free(remap);
+        }
+
+    _free_dictionaries(state);
+    container->dictionaries = dictionaries;
+    PARSER_LOG_INFO("ENCODED %zu OF %zu COLUMNS WITH DICTIONARIES", encoded, container->column_count);
+}
+
+static int _finish_parse(PARSER* parser, PARSE_STATE* state, int header_included)
+{
+    CONTAINER_DATA** lines = state->lines;
+    LINE_INFO* info = state->info;
+    size_t line_count = state->line_count;
+
+    // checking if we can free some memory
+    if (parser->settings.save_memory && line_count > 0 && line_count < state->capacity)
+        {
+            lines = realloc(lines, line_count * sizeof(CONTAINER_DATA*));
+            info = realloc(info, line_count * sizeof(LINE_INFO));
+            STATS_ADD(parser->stats.reallocs, 2);
+        }
+
+    _finish_schema(parser, state);
+    _free_filter_scratch(state);
+    _free_container_dictionaries(&parser->container);
+    _free_indexes(parser);
+    parser->sorted = 0;
+    parser->follow_offset = 0;
+
+    // the new lines replace whatever layout the container had (a loaded snapshot is always columnar)
+    parser->container.layout = ROW_LAYOUT;
+    parser->container.columns = NULL;
+    parser->container.header = NULL;
+    parser->container.string_heap = NULL;
+    parser->container.string_heap_size = 0;
+
+    // setting up our parser attributes, rows of an earlier parse go away with their arena
+    free(parser->container.lines);
+    free(parser->container.info);
+    _arena_free(&parser->arena);
+    _arena_merge(&parser->arena, &state->arena);
+    parser->container.lines = lines;
+    parser->container.info = info;
+    parser->container.column_count = state->column_count;
+    parser->container.line_count = line_count;
+    parser->container.header_included = (line_count > 0) ? header_included : 0;
+
+    // checking for 'bad' headers and making them str, then fixing all the remaining artefacts
+    STATS_START(fixing);
+    if (_check_and_fix_header(parser) || _check_and_fix_parsed_data(parser, 0))
+        {
+            // a row that couldn't be widened would be read past its end, so nothing is kept
+            _free_dictionaries(state);
+            free(parser->container.lines);
+            free(parser->container.info);
+            _arena_free(&parser->arena);
+            parser->container.lines = NULL;
+            parser->container.info = NULL;
+            parser->container.line_count = 0;
+            parser->container.column_count = 0;
+            parser->container.header_included = 0;
+            return 1;
+        }
+    STATS_STOP(parser->stats.fixing, fixing);
+
+    _finish_dictionaries(parser, state);
+
+    if (parser->settings.layout == COLUMNAR_LAYOUT && _convert_to_columnar(parser))
+        PARSER_LOG_WARNING("KEEPING THE ROW LAYOUT");
+    return 0;
+}
+
+static CONTAINER_DATA* _parse_line(const char* line, size_t length, const char* const* separators, size_t separator_count, size_t* token_count, PARSE_STATE* state, int is_header, int transient)
+{
+    // the scanner already knows where every token ends, so the row is allocated only once
+    const char* line_end = line + length;
+    const char* last_start = (separator_count > 0) ? separators[separator_count - 1] + 1 : line;
+    size_t field_count = separator_count + (last_start < line_end ? 1 : 0);
+
+    // with a projection only the kept fields are looked at, the others are never touched
+    const size_t* projection = state->projection;
+    size_t count = (projection) ? state->projection_count : field_count;
+
+    PARSER_ARENA* arena = &state->arena;
+    CONTAINER_DATA* tokens = _arena_alloc(arena, (count > 0 ? count : 1) * sizeof(CONTAINER_DATA));
+    if (!tokens)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR TOKENS");
+            return NULL;
+        }
+
+    // header names are needed right away, so the header is never lazy (or encoded)
+    LAZY_MODE lazy = (is_header) ? LAZY_OFF : state->lazy;
+    // unescaped values keep their own quotes, which only the parse tells apart from enclosing ones
+    if (transient) lazy = LAZY_OFF;
+    int encode = state->encode_strings && !is_header;
+    if (encode && count > state->dictionary_count && _grow_dictionaries(state, count))
+        return NULL;
+
+    for (size_t i = 0; i < count; i++)
+        {
+            size_t field = (projection) ? projection[i] : i;
+            if (field >= field_count)
+                {
+                    _set_null(&tokens[i]); // the line is too short for this column
+                    continue;
+                }
+
+            const char* start = (field == 0) ? line : separators[field - 1] + 1;
+            const char* end = (field < separator_count) ? separators[field] : line_end;
+            if (lazy) tokens[i] = _make_raw(start, end - start, arena, lazy);
+            else
+                {
+                    DATA_TYPE expected = (i < state->schema_size) ? state->schema[i].type : NULL_TYPE;
+                    STRING_TABLE* dictionary = (encode && !state->dictionaries[i].disabled) ? &state->dictionaries[i] : NULL;
+                    tokens[i] = _parse_token(start, end - start, arena, expected, dictionary, state->quoted);
+                }
+
+            // a copy that didn't fit into the arena is left NULL
+            if ((tokens[i].type == STRING_TYPE && !tokens[i].value.string) || (tokens[i].type == RAW_TYPE && !tokens[i].value.raw.data))
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR TOKENS");
+                    return NULL;
+                }
+        }
+
+    *token_count = count;
+#ifdef FILEPARSER_STATS
+    for (size_t i = 0; i < count && !is_header; i++) state->stats.cells[tokens[i].type]++;
+#endif
+
+    return tokens;
+}
+
+static CONTAINER_DATA _parse_token(const char* token, size_t length, PARSER_ARENA* arena, DATA_TYPE expected, STRING_TABLE* dictionary, int quoted)
+{
+    CONTAINER_DATA data;
+    if (expected == NULL_TYPE || _classify_typed_token(&token, &length, &data, expected, quoted))
+        _classify_token(&token, &length, &data, quoted);
+
+    if (data.type != STRING_TYPE)
+        return data;
+
+    // an encoded string is copied only the first time it's met
+    unsigned code;
+    if (dictionary && _string_table_add(dictionary, token, length, _hash_string(token, length), arena, &code) == 0)
+        {
+            data.value.coded.string = dictionary->values[code];
+            data.value.coded.code = code;
+        }
+    else data.value.string = _arena_strndup(arena, token, length);
+    return data;
+}
+
+static void _classify_token(const char** token_ptr, size_t* length_ptr, CONTAINER_DATA* data_ptr, int quoted)
+{
+    // strings are only narrowed down to their text, the caller decides where it goes
+    const char* token = *token_ptr;
+    size_t length = *length_ptr;
+    CONTAINER_DATA data;
+
+    // remove new lines and whitespace, then surrounding quotes
+    _trim_span(&token, &length);
+    if (quoted) _remove_enclosing_quotes(&token, &length);
+    else _remove_quotes(&token, &length);
+    *token_ptr = token;
+    *length_ptr = length;
+
+    // check for NULL/empty values, a quoted field is empty only when it's a bare ""
+    if (length == 0 || (!quoted && _check_for_quotes(token, length) == 2) || (length == 4 && strncasecmp(token, "NULL", 4) == 0))
+        {
+            data.type = NULL_TYPE;
+            data.value.null = NULL;
+            *data_ptr = data;
+            return;
+        }
+
+    // most numbers are classified and converted in one pass right here
+    switch (_parse_number(token, length, &data))
+        {
+            case NUMBER_PARSED:
+                *data_ptr = data;
+                return;
+            case NUMBER_STRING:
+                data.type = STRING_TYPE;
+                data.value.string = NULL;
+                *data_ptr = data;
+                return;
+            case NUMBER_UNKNOWN:
+                break;
+        }
+
+    // strto* functions need a terminated string, so numbers get a copy on the stack
+    char number_buffer[NUMBER_BUFFER_CAPACITY];
+    char* number = number_buffer;
+    if (length >= NUMBER_BUFFER_CAPACITY)
+        {
+            number = malloc(length + 1);
+            if (!number)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR TOKEN");
+                    _set_null(data_ptr);
+                    return;
+                }
+        }
+    memcpy(number, token, length);
+    number[length] = '\0';
+
+    // try parsing as integer
+    char* endptr;
+    ull integer_value = strtoull(number, &endptr, 10);
+    if (*endptr == '\0')
+        {
+            data.type = INTEGER_TYPE;
+            data.value.integer = integer_value;
+        }
+    else
+        {
+            // try parsing as float
+            endptr = NULL;
+            bigfloat float_value = strtold(number, &endptr);
+            if (endptr != NULL && *endptr == '\0')
+                {
+                    data.type = FLOAT_TYPE;
+                    data.value.floating = float_value;
+                }
+            else
+                {
+                    // if neither worked, treat as string
+                    data.type = STRING_TYPE;
+                    data.value.string = NULL;
+                }
+        }
+
+    if (number != number_buffer) free(number);
+    *data_ptr = data;
+}
+
+static int _classify_typed_token(const char** token_ptr, size_t* length_ptr, CONTAINER_DATA* data, DATA_TYPE expected, int quoted)
+{
+    // returns 1 if the token doesn't look like the expected type, the span is left untouched then
+    const char* token = *token_ptr;
+    size_t length = *length_ptr;
+
+    _trim_span(&token, &length);
+    if (quoted) _remove_enclosing_quotes(&token, &length);
+    else _remove_quotes(&token, &length);
+    if (length == 0)
+        return 1;
+
+    switch (expected)
+        {
+            case INTEGER_TYPE:
+                if (_parse_digits(token, length, data))
+                    return 1;
+                break;
+            case FLOAT_TYPE:
+                if (_parse_number(token, length, data) != NUMBER_PARSED)
+                    return 1;
+                break;
+            case STRING_TYPE:
+                {
+                    // anything that can start a number or a NULL goes through the full detection
+                    char first = (char)tolower((unsigned char)*token);
+                    if (isdigit((unsigned char)first) || isspace((unsigned char)first) || first == '-' || first == '+'
+                        || first == '.' || first == 'i' || first == 'n' || _check_for_quotes(token, length) == 2)
+                        return 1;
+
+                    data->type = STRING_TYPE;
+                    data->value.string = NULL;
+                }
+                break;
+            default:
+                return 1;
+        }
+
+    *token_ptr = token;
+    *length_ptr = length;
+    return 0;
+}
+
+static inline int _parse_digits(const char* token, size_t length, CONTAINER_DATA* data)
+{
+    // plain digits only, every other integer is left to the full detection
+    if (length > FAST_NUMBER_MAX_DIGITS)
+        return 1;
+
+    ull value = 0;
+    for (size_t i = 0; i < length; i++)
+        {
+            unsigned digit = (unsigned)(token[i] - '0');
+            if (digit > 9)
+                return 1;
+            value = value * 10 + digit;
+        }
+
+    data->type = INTEGER_TYPE;
+    data->value.integer = value;
+    return 0;
+}
+
+static CONTAINER_DATA _make_raw(const char* token, size_t length, PARSER_ARENA* arena, LAZY_MODE lazy)
+{
+    CONTAINER_DATA data;
+    data.type = RAW_TYPE;
+    data.value.raw.data = (lazy == LAZY_COPIES) ? _arena_strndup(arena, token, length) : token;
+    data.value.raw.length = length;
+    return data;
+}
+
+static inline LAZY_MODE _lazy_mode(const PARSER* parser, int copies)
+{
+    // columns are typed while they are built, so there is nothing to delay in the columnar layout
+    if (!parser->settings.lazy_types || parser->settings.layout != ROW_LAYOUT)
+        return LAZY_OFF;
+    return (copies) ? LAZY_COPIES : LAZY_SLICES;
+}
+
+static void _release_source(PARSER* parser)
+{
+    FILE_VIEW view;
+    view.data = parser->source;
+    view.size = parser->source_size;
+    _unmap_file(&view);
+
+    parser->source = NULL;
+    parser->source_size = 0;
+}
+
+static NUMBER_RESULT _parse_number(const char* token, size_t length, CONTAINER_DATA* data)
+{
+    const char* current = token;
+    const char* end = token + length;
+
+    int negative = 0;
+    if (*current == '-' || *current == '+')
+        {
+            negative = (*current == '-');
+            current++;
+            // signs before "inf", "nan" and friends are left to libc
+            if (current == end || (!isdigit((unsigned char)*current) && *current != '.'))
+                return NUMBER_UNKNOWN;
+        }
+    else if (!isdigit((unsigned char)*current) && *current != '.')
+        {
+            // leading spaces (left by quotes), "inf" and "nan" can still be numbers for libc
+            char first = (char)tolower((unsigned char)*current);
+            if (first == 'i' || first == 'n' || isspace((unsigned char)first))
+                return NUMBER_UNKNOWN;
+            return NUMBER_STRING;
+        }
+
+    // mantissa digits, only the first FAST_NUMBER_MAX_DIGITS significant ones fit into ull
+    ull mantissa = 0;
+    size_t digit_count = 0;
+    size_t significant_digits = 0;
+    int overflow = 0;
+
+    while (current < end && isdigit((unsigned char)*current))
+        {
+            unsigned digit = (unsigned)(*current - '0');
+            if (mantissa > (ULLONG_MAX - digit) / 10) overflow = 1;
+            mantissa = mantissa * 10 + digit;
+            if (significant_digits > 0 || digit != 0) significant_digits++;
+            digit_count++;
+            current++;
+        }
+
+    if (current == end)
+        {
+            // integers behave exactly like strtoull, negative ones wrap around
+            if (overflow)
+                return NUMBER_UNKNOWN;
+            data->type = INTEGER_TYPE;
+            data->value.integer = (negative) ? (ull)0 - mantissa : mantissa;
+            return NUMBER_PARSED;
+        }
+
+    int exponent = 0;
+    if (*current == '.')
+        {
+            current++;
+            while (current < end && isdigit((unsigned char)*current))
+                {
+                    unsigned digit = (unsigned)(*current - '0');
+                    if (mantissa > (ULLONG_MAX - digit) / 10) overflow = 1;
+                    mantissa = mantissa * 10 + digit;
+                    if (significant_digits > 0 || digit != 0) significant_digits++;
+                    digit_count++;
+                    exponent--;
+                    current++;
+                }
+        }
+
+    if (digit_count == 0)
+        return NUMBER_STRING; // ".", "-." and similar
+
+    if (current < end && (*current == 'e' || *current == 'E'))
+        {
+            current++;
+            int exponent_negative = 0;
+            if (current < end && (*current == '-' || *current == '+'))
+                {
+                    exponent_negative = (*current == '-');
+                    current++;
+                }
+            if (current == end || !isdigit((unsigned char)*current))
+                return NUMBER_UNKNOWN;
+
+            int explicit_exponent = 0;
+            while (current < end && isdigit((unsigned char)*current))
+                {
+                    if (explicit_exponent < 100000) explicit_exponent = explicit_exponent * 10 + (*current - '0');
+                    current++;
+                }
+            exponent += (exponent_negative) ? -explicit_exponent : explicit_exponent;
+        }
+    else if (current < end && (*current == 'x' || *current == 'X'))
+        return NUMBER_UNKNOWN; // hex floats
+
+    if (current != end)
+        return NUMBER_STRING;
+
+    // with an exact mantissa and an exact power of ten one operation gives the correctly rounded result
+    if (overflow || significant_digits > FAST_NUMBER_MAX_DIGITS || mantissa > FAST_FLOAT_MAX_MANTISSA
+        || exponent > FAST_FLOAT_MAX_POW10 || exponent < -FAST_FLOAT_MAX_POW10)
+        return NUMBER_UNKNOWN;
+
+    bigfloat value = (bigfloat)mantissa;
+    if (exponent < 0) value /= powers_of_ten[-exponent];
+    else value *= powers_of_ten[exponent];
+
+    data->type = FLOAT_TYPE;
+    data->value.floating = (negative) ? -value : value;
+    return NUMBER_PARSED;
+}
+
+static void _trim_span(const char** str, size_t* len)
+{
+    const char* start = *str;
+    const char* end = start + *len;
+
+    // newlines are whitespace too, so one pass covers both
+    while (start < end && isspace((unsigned char)*start)) start++;
+    while (end > start && isspace((unsigned char)*(end - 1))) end--;
+
+    *str = start;
+    *len = end - start;
+}
+
+static int _check_for_quotes(const char* str, size_t len)
+{
+    if (len >= 2 && str[0] == '"' && str[len-1] == '"')
+        {
+            if (len > 2)
+                return 1;
+            else
+                return 2; // means that str is NULL
+        }
+
+    return 0;
+}
+
+static void _remove_quotes(const char** str, size_t* len)
+{
+    // just narrowing the span, the source stays untouched
+    while (_check_for_quotes(*str, *len) == 1)
+        {
+            (*str)++;
+            *len -= 2;
+        }
+}
+
+static void _remove_enclosing_quotes(const char** str, size_t* len)
+{
+    // with quoted_fields a field has one pair at most, the quotes inside it are part of the value
+    if (_check_for_quotes(*str, *len))
+        {
+            (*str)++;
+            *len -= 2;
+        }
+}
+
+static char* _create_new_header(size_t i, PARSER_ARENA* arena)
+{
+    char new_char[STRING_MAX_WIDTH];
+    int length = snprintf(new_char, STRING_MAX_WIDTH, PARSER_COLUMN_CUSTOM_NAME, i);
+    return _arena_strndup(arena, new_char, (size_t)length);
+}
+
+static int _check_and_fix_header(P_PARSER parser)
+{
+    if (!parser->container.header_included || !parser->container.info[0].is_header)
+        {
+            PARSER_LOG_WARNING("[NO NEED TO FIX ANYTHING] OR [CAN\'T FIX THE HEADER LINE BECAUSE OF THE CONTAINER WRONG STATES]");
+            return 0;
+        }
+
+    PARSER_CONTAINER* data = &parser->container;
+    CONTAINER_DATA* header_line = data->lines[0];
+    LINE_INFO* header_info = &data->info[0];
+
+    size_t header_column_count = header_info->token_count;
+    size_t column_count = data->column_count;
+    size_t i;
+
+    // first we fix current headers
+    for (i = 0; i < header_column_count; i++)
+        {
+            CONTAINER_DATA* current_data = &header_line[i];
+            switch(current_data->type)
+                {
+                    case INTEGER_TYPE:
+                    case FLOAT_TYPE:
+                        {
+                            char* str_val = _container_value_to_str(current_data);
+                            char* name = (str_val) ? _arena_strndup(&parser->arena, str_val, strlen(str_val)) : NULL;
+                            free(str_val);
+                            if (!name)
+                                {
+                                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE HEADER");
+                                    return 1;
+                                }
+                            _set_string(current_data, name);
+                        }
+                        PARSER_LOG_INFO("NEW FIXED HEADER IS %s", current_data->value.string);
+                        break;
+                    case NULL_TYPE:
+                        {
+                            char* name = _create_new_header(i, &parser->arena);
+                            if (!name)
+                                {
+                                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE HEADER");
+                                    return 1;
+                                }
+                            _set_string(current_data, name);
+                        }
+                        PARSER_LOG_INFO("NEW FIXED HEADER IS %s", current_data->value.string);
+                        break;
+                    case STRING_TYPE:
+                    case RAW_TYPE: // the header is never lazy
+                        break;
+                }
+        }
+
+    // after we add a new header if there is a need in that
+    if (header_column_count < column_count)
+        {
+            PARSER_LOG_INFO("FIX IS NEEDED, PREPARING TO FILL THE HEADER LINE WITH %zu MORE VALUES", column_count - header_column_count);
+            header_line = _arena_resize_row(&parser->arena, header_line, header_column_count, column_count);
+            if (!header_line)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE HEADER");
+                    return 1;
+                }
+            data->lines[0] = header_line;
+            for (; i < column_count; i++)
+                {
+                    char* name = _create_new_header(i, &parser->arena);
+                    if (!name)
+                        {
+                            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE HEADER");
+                            return 1;
+                        }
+                    _set_string(&header_line[i], name);
+                    header_info->token_count = i + 1;
+                    PARSER_LOG_INFO("NEW HEADER IS %s", header_line[i].value.string);
+                }
+        }
+
+    return 0;
+}
+
+static int _check_and_fix_parsed_data(P_PARSER parser, size_t first_line)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    CONTAINER_DATA** lines = container->lines;
+    LINE_INFO* info = container->info;
+    size_t column_count = container->column_count;
+    size_t line_count = container->line_count;
+
+    // iterating over all the values to find some 'broken' values
+    for (size_t i = first_line; i < line_count; i++)
+        {
+            CONTAINER_DATA* current_line = lines[i];
+            size_t line_column_count = info[i].token_count;
+
+            if (line_column_count < column_count)
+                {
+                    PARSER_LOG_INFO("ADDING %zu NULL VALUES TO THE %zu LINE", column_count - line_column_count, i);
+                    current_line = _arena_resize_row(&parser->arena, current_line, line_column_count, column_count);
+                    if (!current_line)
+                        {
+                            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR THE %zu LINE", i);
+                            return 1;
+                        }
+                    lines[i] = current_line;
+                    info[i].token_count = column_count;
+                    STATS_ADD(parser->stats.cells[NULL_TYPE], column_count - line_column_count);
+                    for (size_t j = line_column_count; j < column_count; j++)
+                        {
+                            _set_null(&current_line[j]);
+                        }
+                }
+        }
+
+    return 0;
+}
+
+// Sorting functions
+static int _sort_container(PARSER* parser, const PARSER_SORT_SETTINGS* keys, size_t key_count)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    size_t line_count = container->line_count;
+
+    size_t* columns = malloc(key_count * sizeof(size_t));
+    if (!columns)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            return 1;
+        }
+
+    for (size_t k = 0; k < key_count; k++)
+        if (_resolve_sort_column(container, &keys[k], &columns[k]))
+            {
+                free(columns);
+                return 1;
+            }
+
+    // lazy key columns are converted once here, the comparisons only see typed cells
+    for (size_t k = 0; k < key_count; k++)
+        _materialize_column(parser, columns[k]);
+
+    // sorting logic
+    parser->sort_settings = keys[0];
+    parser->sorted = 0;
+    parser->sorted_column = columns[0];
+
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = line_count - start_index;
+
+    if (data_count <= 0)
+        {
+            PARSER_LOG_CRITICAL("NOTHING TO SORT");
+            free(columns);
+            return 1;
+        }
+
+    size_t* indices = malloc(data_count * sizeof(size_t));
+    if (!indices)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            free(columns);
+            return 1;
+        }
+
+    for (size_t i = 0; i < data_count; i++) indices[i] = start_index + i;
+
+    int sort_result = _sort_indices(parser, columns, keys, key_count, indices, data_count);
+    free(columns);
+    if (sort_result)
+        {
+            free(indices);
+            return 1;
+        }
+
+    // columns are reordered in place, it can only fail before the first column is touched
+    if (container->layout == COLUMNAR_LAYOUT)
+        {
+            for (size_t i = 0; i < data_count; i++) indices[i] -= start_index;
+            int result = _permute_columns(container, indices, data_count);
+            for (size_t i = 0; i < data_count; i++) indices[i] += start_index;
+            if (result == 0) _sort_update_indexes(parser, indices, data_count, start_index);
+            free(indices);
+            parser->sorted = (result == 0);
+            return result;
+        }
+
+    LINE_INFO* old_info = container->info;
+    CONTAINER_DATA** old_lines = container->lines;
+    LINE_INFO* sorted_info = malloc(line_count * sizeof(LINE_INFO));
+    CONTAINER_DATA** sorted_lines = malloc(line_count * sizeof(CONTAINER_DATA*));
+
+    if (!sorted_info || !sorted_lines)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            free(indices);
+            free(sorted_info);
+            free(sorted_lines);
+            return 1;
+        }
+
+    for (size_t i = 0; i < data_count; i++)
+        {
+            sorted_info[start_index + i] = old_info[indices[i]];
+            sorted_lines[start_index + i] = old_lines[indices[i]];
+        }
+    if (container->header_included)
+        {
+            sorted_info[0] = old_info[0];
+            sorted_lines[0] = old_lines[0];
+        }
+
+    // the indexes are renamed only once nothing can fail anymore, so they always match the row order
+    _sort_update_indexes(parser, indices, data_count, start_index);
+
+    free(container->lines);
+    free(container->info);
+    free(indices);
+
+    container->lines = sorted_lines;
+    container->info = sorted_info;
+    parser->sorted = 1;
+
+    return 0;
+}
+
+static int _resolve_sort_column(const PARSER_CONTAINER* container, const PARSER_SORT_SETTINGS* settings, size_t* column)
+{
+    // checking if everything is okay and getting column idx
+    if (settings->tag == COLUMN_INDEX)
+        {
+            if (settings->value.column_index >= container->column_count)
+                {
+                    PARSER_LOG_CRITICAL("%zu EXCEEDS NUMBER OF COLUMNS IN PARSED DATA [MAX: %zu]",
+                                        settings->value.column_index, container->column_count);
+                    return 1;
+                }
+            else *column = settings->value.column_index;
+        }
+    else if (settings->tag == COLUMN_NAME)
+        {
+            if (container->header_included ^ 1)
+                {
+                    PARSER_LOG_CRITICAL("TRYING TO SORT FOR %s BUT NO HEADER IN PARSED DATA", settings->value.column_name);
+                    return 1;
+                }
+
+            else
+                {
+                    int found = 0;
+                    size_t i;
+                    PARSER_LOG_INFO("LOOKING FOR: %s", settings->value.column_name);
+                    for (i = 0; i < _row_length(container, 0) && found == 0; i++)
+                        {
+                            CONTAINER_DATA header_cell = _get_cell(container, 0, i);
+                            if (header_cell.type != STRING_TYPE) continue;
+                            PARSER_LOG_INFO("COMAPRING WITH: %s", header_cell.value.string);
+                            if (strcasecmp(header_cell.value.string, settings->value.column_name) == 0)
+                                {
+                                    PARSER_LOG_INFO("FOUND THE HEADER %s [COLUMN: %zu]", settings->value.column_name, i);
+                                    found = 1;
+                                    break;
+                                }
+
+                        }
+                    if (found) *column = i;
+                    else
+                        {
+                            PARSER_LOG_CRITICAL("COULDN'T FIND THE HEADER: %s", settings->value.column_name);
+                            return 1;
+                        }
+                }
+        }
+    else
+        {
+            PARSER_LOG_CRITICAL("UNKNOWN SORT SETTINGS TAG: %d", (int)settings->tag);
+            return 1;
+        }
+
+    return 0;
+}
+
+static int _sort_indices(PARSER* parser, const size_t* columns, const PARSER_SORT_SETTINGS* keys, size_t key_count, size_t* indices, size_t count)
+{
+    SORT_CONTEXT context;
+    context.container = &parser->container;
+    context.columns = columns;
+    context.keys = keys;
+    context.key_count = key_count;
+    context.key_type = NULL_TYPE;
+#ifdef FILEPARSER_STATS
+    size_t comparisons = 0;
+    context.comparisons = &comparisons;
+#endif
+
+    const PARSER_DICTIONARY** dictionaries = malloc(key_count * sizeof(PARSER_DICTIONARY*));
+    if (!dictionaries)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            return 1;
+        }
+    for (size_t k = 0; k < key_count; k++)
+        dictionaries[k] = _column_dictionary(&parser->container, columns[k]);
+    context.dictionaries = dictionaries;
+
+    int uniform = 1;
+    DATA_TYPE type = NULL_TYPE;
+    for (size_t k = 0; k < key_count && uniform; k++)
+        uniform = _column_type(&parser->container, columns[k], indices, count, &type);
+
+    // cells of different types are compared as strings, so only a single column of one numeric type
+    // (or of dictionary codes) can use radix keys
+    if (uniform && key_count == 1 && (type == INTEGER_TYPE || type == FLOAT_TYPE || (type == STRING_TYPE && dictionaries[0])))
+        context.key_type = type;
+#ifndef RADIX_FLOAT_KEYS
+    if (context.key_type == FLOAT_TYPE) context.key_type = NULL_TYPE;
+#endif
+
+    size_t thread_count = _resolve_thread_count(parser->settings.thread_count);
+    size_t max_threads = count / PARALLEL_MIN_SORT_SIZE;
+    if (thread_count > max_threads) thread_count = max_threads;
+
+    // mixed columns have no total order (10 < 9 as strings), merging their runs could differ from one serial sort
+    int result;
+    if (thread_count > 1 && uniform)
+        result = _sort_parallel(&context, indices, count, thread_count);
+    else
+        result = _sort_run(&context, indices, count);
+
+    STATS_ADD(parser->stats.comparisons, comparisons);
+    free(dictionaries);
+    return result;
+}
+
+static int _column_type(const PARSER_CONTAINER* container, size_t sort_column, const size_t* indices, size_t count, DATA_TYPE* type)
+{
+    // returns 1 when every non-NULL cell has the same type
+    DATA_TYPE found = NULL_TYPE;
+    for (size_t i = 0; i < count; i++)
+        {
+            DATA_TYPE cell_type = _get_cell(container, indices[i], sort_column).type;
+            if (cell_type == NULL_TYPE || cell_type == found) continue;
+            if (found != NULL_TYPE) return 0;
+            found = cell_type;
+        }
+
+    *type = found;
+    return 1;
+}
+
+static int _sort_run(const SORT_CONTEXT* context, size_t* indices, size_t count)
+{
+    if (context->key_type != NULL_TYPE)
+        return _radix_sort(context, indices, count);
+
+    // every comparison works on the extracted cells, not on the container
+    size_t extra_keys = context->key_count - 1;
+    SORT_ITEM* items = malloc(count * sizeof(SORT_ITEM));
+    CONTAINER_DATA* keys = (extra_keys) ? malloc(count * extra_keys * sizeof(CONTAINER_DATA)) : NULL;
+    if (!items || (extra_keys && !keys))
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            free(items);
+            free(keys);
+            return 1;
+        }
+
+    for (size_t i = 0; i < count; i++)
+        {
+            items[i].cell = _get_cell(context->container, indices[i], context->columns[0]);
+            items[i].keys = (extra_keys) ? keys + i * extra_keys : NULL;
+            items[i].index = indices[i];
+
+            // the other keys of a row are stored together, so a tie on the first key stays in one place
+            for (size_t k = 1; k < context->key_count; k++)
+                keys[i * extra_keys + k - 1] = _get_cell(context->container, indices[i], context->columns[k]);
+        }
+
+    _intro_sort(items, count, context);
+
+    for (size_t i = 0; i < count; i++) indices[i] = items[i].index;
+
+    free(items);
+    free(keys);
+    return 0;
+}
+
+static int _sort_parallel(const SORT_CONTEXT* context, size_t* indices, size_t count, size_t thread_count)
+{
+#ifdef FILEPARSER_NO_THREADS
+    (void)thread_count;
+    return _sort_run(context, indices, count);
+#else
+    SORT_TASK* tasks = calloc(thread_count, sizeof(SORT_TASK));
+    MERGE_TASK* merges = calloc(thread_count * 2, sizeof(MERGE_TASK));
+    pthread_t* threads = malloc(thread_count * 2 * sizeof(pthread_t));
+    int* started = calloc(thread_count * 2, sizeof(int));
+    size_t* buffer = malloc(count * sizeof(size_t));
+    size_t* bounds = malloc((thread_count + 1) * sizeof(size_t));
+    if (!tasks || !merges || !threads || !started || !buffer || !bounds)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR SORTING THREADS, SORTING IN ONE THREAD");
+            free(tasks);
+            free(merges);
+            free(threads);
+            free(started);
+            free(buffer);
+            free(bounds);
+            return _sort_run(context, indices, count);
+        }
+
+    // every thread sorts its own slice with the serial algorithm
+    for (size_t i = 0; i <= thread_count; i++)
+        bounds[i] = count / thread_count * i + ((i == thread_count) ? count % thread_count : 0);
+
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            tasks[i].context = context;
+            tasks[i].indices = indices + bounds[i];
+            tasks[i].count = bounds[i + 1] - bounds[i];
+            started[i] = (pthread_create(&threads[i], NULL, _sort_task_run, &tasks[i]) == 0);
+        }
+
+    int result = 0;
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            if (started[i]) pthread_join(threads[i], NULL);
+            else _sort_task_run(&tasks[i]);
+            if (tasks[i].result) result = 1;
+            STATS_ADD(*context->comparisons, tasks[i].comparisons);
+        }
+
+    // merging neighbour runs pairwise, every merge is split between threads along its merge path
+    size_t* source = indices;
+    size_t* target = buffer;
+    size_t run_count = thread_count;
+
+    while (result == 0 && run_count > 1)
+        {
+            size_t pair_count = run_count / 2;
+            size_t threads_per_pair = (thread_count > pair_count) ? thread_count / pair_count : 1;
+            size_t task_count = 0;
+
+            for (size_t pair = 0; pair < pair_count; pair++)
+                {
+                    size_t left_begin = bounds[pair * 2];
+                    size_t right_begin = bounds[pair * 2 + 1];
+                    size_t right_end = bounds[pair * 2 + 2];
+                    size_t total = right_end - left_begin;
+
+                    for (size_t t = 0; t < threads_per_pair; t++)
+                        {
+                            MERGE_TASK* merge = &merges[task_count++];
+                            merge->context = context;
+                            merge->left = source + left_begin;
+                            merge->left_count = right_begin - left_begin;
+                            merge->right = source + right_begin;
+                            merge->right_count = right_end - right_begin;
+                            merge->output = target + left_begin;
+                            merge->output_begin = total / threads_per_pair * t;
+                            merge->output_end = (t == threads_per_pair - 1) ? total : total / threads_per_pair * (t + 1);
+                        }
+                }
+
+            // the odd run out has nobody to merge with, it is just carried over
+            if (run_count % 2)
+                memcpy(target + bounds[run_count - 1], source + bounds[run_count - 1],
+                       (bounds[run_count] - bounds[run_count - 1]) * sizeof(size_t));
+
+            for (size_t i = 0; i < task_count; i++)
+                started[i] = (pthread_create(&threads[i], NULL, _merge_task_run, &merges[i]) == 0);
+
+            for (size_t i = 0; i < task_count; i++)
+                {
+                    if (started[i]) pthread_join(threads[i], NULL);
+                    else _merge_task_run(&merges[i]);
+                    STATS_ADD(*context->comparisons, merges[i].comparisons);
+                }
+
+            for (size_t pair = 0; pair < pair_count; pair++)
+                bounds[pair + 1] = bounds[pair * 2 + 2];
+            if (run_count % 2)
+                bounds[pair_count + 1] = bounds[run_count];
+            run_count = pair_count + run_count % 2;
+
+            size_t* temp = source;
+            source = target;
+            target = temp;
+        }
+
+    if (result == 0 && source != indices)
+        memcpy(indices, source, count * sizeof(size_t));
+
+    PARSER_LOG_INFO("SORTED %zu ROWS IN %zu THREADS", count, thread_count);
+
+    free(tasks);
+    free(merges);
+    free(threads);
+    free(started);
+    free(buffer);
+    free(bounds);
+    return result;
+#endif
+}
+
+#ifndef FILEPARSER_NO_THREADS
+static void* _sort_task_run(void* arg)
+{
+    SORT_TASK* task = arg;
+#ifdef FILEPARSER_STATS
+    // every thread counts its comparisons in its own task, they are added up after the join
+    SORT_CONTEXT local = *task->context;
+    local.comparisons = &task->comparisons;
+    task->result = _sort_run(&local, task->indices, task->count);
+#else
+    task->result = _sort_run(task->context, task->indices, task->count);
+#endif
+    return NULL;
+}
+
+static void* _merge_task_run(void* arg)
+{
+    MERGE_TASK* task = arg;
+#ifdef FILEPARSER_STATS
+    SORT_CONTEXT local = *task->context;
+    local.comparisons = &task->comparisons;
+    const SORT_CONTEXT* context = &local;
+#else
+    const SORT_CONTEXT* context = task->context;
+#endif
+
+    size_t i = _merge_path_split(context, task->left, task->left_count, task->right, task->right_count, task->output_begin);
+    size_t j = task->output_begin - i;
+
+    for (size_t k = task->output_begin; k < task->output_end; k++)
+        {
+            if (j >= task->right_count || (i < task->left_count && _compare_rows(context, task->left[i], task->right[j]) < 0))
+                task->output[k] = task->left[i++];
+            else
+                task->output[k] = task->right[j++];
+        }
+
+    return NULL;
+}
+
+static size_t _merge_path_split(const SORT_CONTEXT* context, const size_t* left, size_t left_count, const size_t* right, size_t right_count, size_t diagonal)
+{
+    // binary search for how many of the first `diagonal` merged items come from the left run
+    size_t low = (diagonal > right_count) ? diagonal - right_count : 0;
+    size_t high = (diagonal < left_count) ? diagonal : left_count;
+
+    while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            if (_compare_rows(context, left[middle], right[diagonal - middle - 1]) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+
+    return low;
+}
+
+static int _compare_rows(const SORT_CONTEXT* context, size_t row_a, size_t row_b)
+{
+    STATS_ADD(*context->comparisons, 1);
+    if (context->key_type == NULL_TYPE)
+        {
+            for (size_t k = 0; k < context->key_count; k++)
+                {
+                    CONTAINER_DATA cell_a = _get_cell(context->container, row_a, context->columns[k]);
+                    CONTAINER_DATA cell_b = _get_cell(context->container, row_b, context->columns[k]);
+                    int result = _compare_cells(&cell_a, &cell_b, &context->keys[k], context->dictionaries[k]);
+                    if (result != 0) return result;
+                }
+
+            return (row_a < row_b) ? -1 : (row_a > row_b);
+        }
+
+    CONTAINER_DATA cell_a = _get_cell(context->container, row_a, context->columns[0]);
+    CONTAINER_DATA cell_b = _get_cell(context->container, row_b, context->columns[0]);
+
+    // has to give exactly the order of _radix_sort, NaNs included
+    int descending = (context->keys[0].direction == DESCENDING);
+    if (cell_a.type == NULL_TYPE || cell_b.type == NULL_TYPE)
+        {
+            if (cell_a.type != cell_b.type)
+                return ((cell_a.type == NULL_TYPE) ^ descending) ? 1 : -1;
+        }
+    else
+        {
+            uint64_t low_a, high_a, low_b, high_b;
+            _radix_key(context, &cell_a, &low_a, &high_a);
+            _radix_key(context, &cell_b, &low_b, &high_b);
+
+            if (high_a != high_b) return ((high_a < high_b) ^ descending) ? -1 : 1;
+            if (low_a != low_b) return ((low_a < low_b) ^ descending) ? -1 : 1;
+        }
+
+    return (row_a < row_b) ? -1 : 1;
+}
+#endif
+
+static int _radix_sort(const SORT_CONTEXT* context, size_t* indices, size_t count)
+{
+    const PARSER_CONTAINER* container = context->container;
+    const PARSER_SORT_SETTINGS* settings = &context->keys[0];
+    size_t sort_column = context->columns[0];
+
+    RADIX_ITEM* items = malloc(count * sizeof(RADIX_ITEM));
+    RADIX_ITEM* buffer = malloc(count * sizeof(RADIX_ITEM));
+    size_t (*histograms)[256] = calloc(RADIX_PASSES, sizeof(*histograms));
+
+    if (!items || !buffer || !histograms)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            free(items);
+            free(buffer);
+            free(histograms);
+            return 1;
+        }
+
+    // NULLs don't take part in the sort, they just go to the end (or to the front when descending)
+    size_t null_count = 0;
+    size_t item_count = 0;
+    uint64_t flip = (settings->direction == DESCENDING) ? ~(uint64_t)0 : 0;
+
+    for (size_t i = 0; i < count; i++)
+        {
+            CONTAINER_DATA cell = _get_cell(container, indices[i], sort_column);
+            if (cell.type == NULL_TYPE)
+                {
+                    indices[null_count++] = indices[i];
+                    continue;
+                }
+
+            RADIX_ITEM* item = &items[item_count++];
+            _radix_key(context, &cell, &item->low, &item->high);
+            item->low ^= flip;
+            item->high ^= flip & 0xFFFF;
+            item->index = indices[i];
+
+            for (size_t pass = 0; pass < RADIX_PASSES; pass++)
+                histograms[pass][_radix_byte(item, pass)]++;
+        }
+
+    // stable LSD passes, skipping the bytes that are the same everywhere
+    for (size_t pass = 0; pass < RADIX_PASSES; pass++)
+        {
+            size_t* histogram = histograms[pass];
+            if (item_count == 0 || histogram[_radix_byte(&items[0], pass)] == item_count)
+                continue;
+
+            size_t offset = 0;
+            for (size_t b = 0; b < 256; b++)
+                {
+                    size_t bucket = histogram[b];
+                    histogram[b] = offset;
+                    offset += bucket;
+                }
+
+            for (size_t i = 0; i < item_count; i++)
+                buffer[histogram[_radix_byte(&items[i], pass)]++] = items[i];
+
+            RADIX_ITEM* temp = items;
+            items = buffer;
+            buffer = temp;
+        }
+
+    PARSER_LOG_DEBUG("[RADIX SORT] - SORTED %zu KEYS, %zu NULLS", item_count, null_count);
+
+    // nulls are already compacted at the front of indices, moving them after the keys if needed
+    if (settings->direction == DESCENDING)
+        for (size_t i = 0; i < item_count; i++) indices[null_count + i] = items[i].index;
+    else
+        {
+            memmove(indices + item_count, indices, null_count * sizeof(size_t));
+            for (size_t i = 0; i < item_count; i++) indices[i] = items[i].index;
+        }
+
+    free(items);
+    free(buffer);
+    free(histograms);
+    return 0;
+}
+
+static void _radix_key(const SORT_CONTEXT* context, const CONTAINER_DATA* cell, uint64_t* low, uint64_t* high)
+{
+    *high = 0;
+
+    if (context->key_type == INTEGER_TYPE)
+        {
+            *low = cell->value.integer;
+            return;
+        }
+
+    // dictionary codes are already in string order
+    if (context->key_type == STRING_TYPE)
+        {
+            unsigned code = cell->value.coded.code;
+            *low = (context->keys[0].case_sensitive) ? code : context->dictionaries[0]->folded[code];
+            return;
+        }
+
+#ifdef RADIX_FLOAT_KEYS
+    // -0 and 0 compare equal, so they get the same key
+    bigfloat value = (cell->value.floating == 0) ? 0.0L : cell->value.floating;
+
+#if RADIX_FLOAT_KEYS == 80
+    // x87 extended: 64 bit mantissa, then 16 bits of sign and exponent
+    unsigned char bytes[sizeof(bigfloat)];
+    memcpy(bytes, &value, sizeof(bigfloat));
+    memcpy(low, bytes, sizeof(uint64_t));
+    *high = (uint64_t)bytes[8] | ((uint64_t)bytes[9] << 8);
+
+    // making the bit patterns order like the values: negative ones are inverted, positive get the sign bit
+    if (*high & 0x8000)
+        {
+            *low = ~*low;
+            *high = ~*high & 0xFFFF;
+        }
+    else *high |= 0x8000;
+#else
+    double as_double = (double)value;
+    memcpy(low, &as_double, sizeof(uint64_t));
+    if (*low >> 63) *low = ~*low;
+    else *low |= (uint64_t)1 << 63;
+#endif
+#endif
+}
+
+static inline unsigned _radix_byte(const RADIX_ITEM* item, size_t pass)
+{
+    return (pass < 8) ? (unsigned)((item->low >> (pass * 8)) & 0xFF)
+           : (unsigned)((item->high >> ((pass - 8) * 8)) & 0xFF);
+}
+
+static void _intro_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context)
+{
+    size_t depth = 0;
+    for (size_t n = count; n > 1; n >>= 1) depth += 2;
+
+    _intro_sort_loop(items, count, depth, context);
+}
+
+static void _intro_sort_loop(SORT_ITEM* items, size_t count, size_t depth, const SORT_CONTEXT* context)
+{
+    while (count > INSERTION_SORT_THRESHOLD)
+        {
+            // too many bad pivots, heapsort keeps it O(n log n)
+            if (depth == 0)
+                {
+                    _heap_sort(items, count, context);
+                    return;
+                }
+            depth--;
+
+            size_t pivot = _partition(items, count, context);
+
+            // recursing into the smaller part only, so the stack stays O(log n)
+            size_t left_count = pivot;
+            size_t right_count = count - pivot - 1;
+            if (left_count < right_count)
+                {
+                    _intro_sort_loop(items, left_count, depth, context);
+                    items += pivot + 1;
+                    count = right_count;
+                }
+            else
+                {
+                    _intro_sort_loop(items + pivot + 1, right_count, depth, context);
+                    count = left_count;
+                }
+        }
+
+    _insertion_sort(items, count, context);
+}
+
+static size_t _partition(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context)
+{
+    PARSER_LOG_DEBUG("[INTRO SORT] - PARTITION OF %zu ITEMS", count);
+
+    // median of three as the pivot, moved to the end
+    size_t middle = count / 2;
+    size_t last = count - 1;
+    if (_compare_items(&items[middle], &items[0], context) < 0) _swap_items(&items[middle], &items[0]);
+    if (_compare_items(&items[last], &items[0], context) < 0) _swap_items(&items[last], &items[0]);
+    if (_compare_items(&items[middle], &items[last], context) < 0) _swap_items(&items[middle], &items[last]);
+
+    size_t i = 0;
+    for (size_t j = 0; j < last; j++)
+        if (_compare_items(&items[j], &items[last], context) < 0)
+            _swap_items(&items[i++], &items[j]);
+    _swap_items(&items[i], &items[last]);
+
+    PARSER_LOG_DEBUG("[INTRO SORT] - PARTITION KEY: %zu", i);
+    return i;
+}
+
+static void _heap_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context)
+{
+    for (size_t i = count / 2; i > 0; i--)
+        _sift_down(items, i - 1, count, context);
+
+    for (size_t end = count - 1; end > 0; end--)
+        {
+            _swap_items(&items[0], &items[end]);
+            _sift_down(items, 0, end, context);
+        }
+}
+
+static void _sift_down(SORT_ITEM* items, size_t root, size_t count, const SORT_CONTEXT* context)
+{
+    for (;;)
+        {
+            size_t child = root * 2 + 1;
+            if (child >= count) return;
+            if (child + 1 < count && _compare_items(&items[child], &items[child + 1], context) < 0) child++;
+            if (_compare_items(&items[root], &items[child], context) >= 0) return;
+            _swap_items(&items[root], &items[child]);
+            root = child;
+        }
+}
+
+static void _insertion_sort(SORT_ITEM* items, size_t count, const SORT_CONTEXT* context)
+{
+    for (size_t i = 1; i < count; i++)
+        {
+            SORT_ITEM current = items[i];
+            size_t j = i;
+            while (j > 0 && _compare_items(&current, &items[j - 1], context) < 0)
+                {
+                    items[j] = items[j - 1];
+                    j--;
+                }
+            items[j] = current;
+        }
+}
+
+static inline int _compare_items(const SORT_ITEM* a, const SORT_ITEM* b, const SORT_CONTEXT* context)
+{
+    STATS_ADD(*context->comparisons, 1);
+    int result = _compare_cells(&a->cell, &b->cell, &context->keys[0], context->dictionaries[0]);
+    for (size_t k = 1; result == 0 && k < context->key_count; k++)
+        result = _compare_cells(&a->keys[k - 1], &b->keys[k - 1], &context->keys[k], context->dictionaries[k]);
+    if (result != 0) return result;
+
+    // equal cells keep their original order, so every sort gives the same (stable) result
+    return (a->index < b->index) ? -1 : (a->index > b->index);
+}
+
+static int _compare_cells(const CONTAINER_DATA* cell_a, const CONTAINER_DATA* cell_b, const PARSER_SORT_SETTINGS* settings, const PARSER_DICTIONARY* dictionary)
+{
+    int result = 0;
+    if (cell_a->type == cell_b->type)
+        {
+            switch (cell_a->type)
+                {
+                    case INTEGER_TYPE:
+                        if (cell_a->value.integer < cell_b->value.integer) result = -1;
+                        else if (cell_a->value.integer > cell_b->value.integer) result = 1;
+                        else result = 0;
+                        break;
+                    case FLOAT_TYPE:
+                        if (cell_a->value.floating < cell_b->value.floating) result = -1;
+                        else if (cell_a->value.floating > cell_b->value.floating) result = 1;
+                        else result = _compare_nan(cell_a->value.floating, cell_b->value.floating);
+                        break;
+                    case STRING_TYPE:
+                        if (dictionary)
+                            {
+                                // the dictionary is sorted, so codes compare like the strings
+                                unsigned rank_a = cell_a->value.coded.code;
+                                unsigned rank_b = cell_b->value.coded.code;
+                                if (!settings->case_sensitive)
+                                    {
+                                        rank_a = dictionary->folded[rank_a];
+                                        rank_b = dictionary->folded[rank_b];
+                                    }
+                                result = (rank_a > rank_b) - (rank_a < rank_b);
+                            }
+                        else if (settings->case_sensitive)
+                            result = strcmp(cell_a->value.string, cell_b->value.string);
+                        else
+                            result = strcasecmp(cell_a->value.string, cell_b->value.string);
+                        break;
+                    case NULL_TYPE:
+                        result =  0; // equality muthafaka
+                        break;
+                    default:
+                        exit(1); // just in case
+                }
+        }
+    else if (cell_a->type == NULL_TYPE || cell_b->type == NULL_TYPE)
+        {
+            if (cell_a->type == NULL_TYPE) result = 1;
+            else result = -1;
+        }
+    else
+        {
+            char str_a[STRING_MAX_WIDTH];
+            char str_b[STRING_MAX_WIDTH];
+            _format_value(cell_a, str_a, STRING_MAX_WIDTH);
+            _format_value(cell_b, str_b, STRING_MAX_WIDTH);
+
+            if (settings->case_sensitive)
+                result = strcmp(str_a, str_b);
+            else
+                result = strcasecmp(str_a, str_b);
+        }
+
+    if (settings->direction == DESCENDING)
+        result = -result;
+
+    PARSER_LOG_DEBUG("[COMPARE FUNCTION] - COMPARING RESULT: %d", result);
+    return result;
+}
+
+static inline int _compare_nan(bigfloat a, bigfloat b)
+{
+    // NaN is unordered, so it gets a fixed place like in the radix keys: -NaN before every number, NaN after
+    int rank_a = (a != a) ? (signbit(a) ? -1 : 1) : 0;
+    int rank_b = (b != b) ? (signbit(b) ? -1 : 1) : 0;
+    return (rank_a > rank_b) - (rank_a < rank_b);
+}
+
+static inline void _swap_items(SORT_ITEM* a, SORT_ITEM* b)
+{
+    SORT_ITEM temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+// Scanning functions
+static int _scanner_init(LINE_SCANNER* scanner, char splitter, int quoted)
+{
+    scanner->splitter = splitter;
+    scanner->quoted = quoted;
+    scanner->unescaped = NULL;
+    scanner->unescaped_capacity = 0;
+    scanner->separator_count = 0;
+    scanner->separator_capacity = INITIAL_TOKENS_CAPACITY;
+    scanner->separators = malloc(scanner->separator_capacity * sizeof(const char*));
+    if (!scanner->separators)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR SCANNER");
+            return 1;
+        }
+
+    _scanner_reset(scanner, NULL, NULL);
+    return 0;
+}
+
+static void _scanner_reset(LINE_SCANNER* scanner, const char* begin, const char* end)
+{
+    scanner->line_start = begin;
+    scanner->end = end;
+    scanner->block = begin;
+    scanner->next_block = begin;
+    scanner->mask = 0;
+    scanner->inside = 0;
+    scanner->last_quote = 0;
+    scanner->last_escape = NULL;
+    scanner->transient = 0;
+}
+
+static void _scanner_free(LINE_SCANNER* scanner)
+{
+    free(scanner->separators);
+    free(scanner->unescaped);
+    scanner->separators = NULL;
+    scanner->unescaped = NULL;
+}
+
+static int _scanner_next_line(LINE_SCANNER* scanner, const char** line, size_t* length)
+{
+    if (scanner->line_start >= scanner->end)
+        return 1;
+
+    scanner->separator_count = 0;
+    scanner->transient = 0;
+
+    for (;;)
+        {
+            // taking the next block once all the positions in the current one are used up
+            while (scanner->mask == 0)
+                {
+                    if (scanner->next_block >= scanner->end)
+                        {
+                            // the last line has no '\n' at the end
+                            *line = scanner->line_start;
+                            *length = scanner->end - scanner->line_start;
+                            scanner->line_start = scanner->end;
+                            if (scanner->last_escape && scanner->last_escape >= *line)
+                                return _scanner_unescape(scanner, line, length);
+                            return 0;
+                        }
+                    _scanner_load_block(scanner);
+                }
+
+            const char* position = scanner->block + _count_trailing_zeros(scanner->mask);
+            scanner->mask &= scanner->mask - 1;
+
+            if (*position == '\n')
+                {
+                    *line = scanner->line_start;
+                    *length = position + 1 - scanner->line_start;
+                    scanner->line_start = position + 1;
+                    if (scanner->last_escape && scanner->last_escape >= *line)
+                        return _scanner_unescape(scanner, line, length);
+                    return 0;
+                }
+
+            if (scanner->separator_count >= scanner->separator_capacity)
+                {
+                    size_t new_capacity = scanner->separator_capacity;
+                    INCREASE_CAP(&new_capacity);
+                    const char** new_separators = realloc(scanner->separators, new_capacity * sizeof(const char*));
+                    if (!new_separators)
+                        {
+                            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR SCANNER");
+                            return -1;
+                        }
+                    scanner->separators = new_separators;
+                    scanner->separator_capacity = new_capacity;
+                }
+            scanner->separators[scanner->separator_count++] = position;
+        }
+}
+
+static void _scanner_load_block(LINE_SCANNER* scanner)
+{
+    BLOCK_MASKS masks;
+    const char* block = scanner->next_block;
+    size_t remaining = scanner->end - block;
+
+    if (remaining >= SCAN_BLOCK_SIZE)
+        scan_block(block, scanner->splitter, &masks);
+    else
+        {
+            // never reading past the end of the input (it may be the end of a mapping)
+            char padded[SCAN_BLOCK_SIZE] = {0};
+            memcpy(padded, block, remaining);
+            scan_block(padded, scanner->splitter, &masks);
+            uint64_t valid = ((uint64_t)1 << remaining) - 1;
+            masks.splitter &= valid;
+            masks.newline &= valid;
+            masks.quote &= valid;
+        }
+
+    scanner->block = block;
+    scanner->next_block = block + SCAN_BLOCK_SIZE;
+    scanner->mask = masks.splitter | masks.newline;
+    if (!scanner->quoted)
+        return;
+
+    // the prefix xor sets every bit after an odd number of quotes, so the whole quoted text is masked out at once;
+    // a "" escape leaves the quotes and enters them again, so its second quote is a quote with the bit set right after a quote
+    uint64_t inside = _prefix_xor(masks.quote) ^ scanner->inside;
+    uint64_t escapes = masks.quote & ((masks.quote << 1) | scanner->last_quote) & inside;
+    if (escapes) scanner->last_escape = block + (SCAN_BLOCK_SIZE - 1) - _count_leading_zeros(escapes);
+    scanner->inside = (uint64_t)0 - (inside >> (SCAN_BLOCK_SIZE - 1));
+    scanner->last_quote = masks.quote >> (SCAN_BLOCK_SIZE - 1);
+    scanner->mask &= ~inside;
+}
+
+static int _scanner_unescape(LINE_SCANNER* scanner, const char** line, size_t* length)
+{
+    // lines with "" escapes are copied with one quote for each of them, the enclosing quotes stay like in any quoted field
+    if (*length > scanner->unescaped_capacity)
+        {
+            char* new_buffer = realloc(scanner->unescaped, *length);
+            if (!new_buffer)
+                {
+                    PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR SCANNER");
+                    return -1;
+                }
+            scanner->unescaped = new_buffer;
+            scanner->unescaped_capacity = *length;
+        }
+
+    const char* line_end = *line + *length;
+    char* output = scanner->unescaped;
+    for (size_t field = 0; field <= scanner->separator_count; field++)
+        {
+            const char* start = (field == 0) ? *line : scanner->separators[field - 1] + 1;
+            const char* end = (field < scanner->separator_count) ? scanner->separators[field] : line_end;
+            if (field > 0)
+                {
+                    scanner->separators[field - 1] = output;
+                    *output++ = scanner->splitter;
+                }
+
+            const char* current = start;
+            while (current < end && isspace((unsigned char)*current)) *output++ = *current++;
+            if (current < end && *current == '"')
+                {
+                    *output++ = *current++;
+                    const char* quote;
+                    while ((quote = memchr(current, '"', end - current)))
+                        {
+                            memcpy(output, current, quote - current);
+                            output += quote - current;
+                            *output++ = '"';
+                            current = quote + 1;
+                            if (current == end || *current != '"')
+                                break; // the closing quote, anything after it is copied as it is
+                            current++;
+                        }
+                }
+            memcpy(output, current, end - current);
+            output += end - current;
+        }
+
+    *line = scanner->unescaped;
+    *length = output - scanner->unescaped;
+    scanner->transient = 1;
+    return 0;
+}
+
+static void _scan_block_scalar(const char* block, char splitter, BLOCK_MASKS* masks)
+{
+    uint64_t splitter_mask = 0;
+    uint64_t newline_mask = 0;
+    uint64_t quote_mask = 0;
+
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i++)
+        {
+            splitter_mask |= (uint64_t)(block[i] == splitter) << i;
+            newline_mask |= (uint64_t)(block[i] == '\n') << i;
+            quote_mask |= (uint64_t)(block[i] == '"') << i;
+        }
+
+    masks->splitter = splitter_mask;
+    masks->newline = newline_mask;
+    masks->quote = quote_mask;
+}
+
+#ifdef FILEPARSER_HAS_SSE2
+static void _scan_block_sse2(const char* block, char splitter, BLOCK_MASKS* masks)
+{
+    const __m128i splitters = _mm_set1_epi8(splitter);
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i quotes = _mm_set1_epi8('"');
+    uint64_t splitter_mask = 0;
+    uint64_t newline_mask = 0;
+    uint64_t quote_mask = 0;
+
+    for (size_t i = 0; i < SCAN_BLOCK_SIZE; i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(block + i));
+            splitter_mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, splitters)) << i;
+            newline_mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines)) << i;
+            quote_mask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quotes)) << i;
+        }
+
+    masks->splitter = splitter_mask;
+    masks->newline = newline_mask;
+    masks->quote = quote_mask;
+}
+#endif
+
+#ifdef FILEPARSER_HAS_AVX2
+__attribute__((target("avx2")))
+static void _scan_block_avx2(const char* block, char splitter, BLOCK_MASKS* masks)
+{
+    const __m256i splitters = _mm256_set1_epi8(splitter);
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    const __m256i quotes = _mm256_set1_epi8('"');
+
+    __m256i low = _mm256_loadu_si256((const __m256i*)block);
+    __m256i high = _mm256_loadu_si256((const __m256i*)(block + 32));
+
+    masks->splitter = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, splitters))
+                      | (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, splitters)) << 32;
+    masks->newline = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, newlines))
+                     | (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, newlines)) << 32;
+    masks->quote = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, quotes))
+                   | (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, quotes)) << 32;
+}
+#endif
+
+static BlockScanner _select_block_scanner()
+{
+#ifdef FILEPARSER_HAS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        {
+            PARSER_LOG_INFO("USING AVX2 SCANNER");
+            return _scan_block_avx2;
+        }
+#endif
+#ifdef FILEPARSER_HAS_SSE2
+    PARSER_LOG_INFO("USING SSE2 SCANNER");
+    return _scan_block_sse2;
+#else
+    PARSER_LOG_INFO("USING SCALAR SCANNER");
+    return _scan_block_scalar;
+#endif
+}
+
+static inline unsigned _count_trailing_zeros(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (unsigned)index;
+#else
+    unsigned count = 0;
+    while ((mask & 1) == 0)
+        {
+            mask >>= 1;
+            count++;
+        }
+    return count;
+#endif
+}
+
+static inline unsigned _count_leading_zeros(uint64_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_clzll(mask);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return 63 - (unsigned)index;
+#else
+    unsigned count = 0;
+    while ((mask & ((uint64_t)1 << 63)) == 0)
+        {
+            mask <<= 1;
+            count++;
+        }
+    return count;
+#endif
+}
+
+static inline uint64_t _prefix_xor(uint64_t mask)
+{
+    // bit i becomes the parity of the bits 0..i, the portable form of a carry-less multiply by all ones
+    mask ^= mask << 1;
+    mask ^= mask << 2;
+    mask ^= mask << 4;
+    mask ^= mask << 8;
+    mask ^= mask << 16;
+    mask ^= mask << 32;
+    return mask;
+}
+
+// File mapping
+static int _map_file(const char* filename, FILE_VIEW* view, int writable)
+{
+    // writable mappings are copy on write, the changes never reach the file
+    view->data = NULL;
+    view->size = 0;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return 1;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            return 1;
+        }
+
+    // empty files can't be mapped, but there is nothing to parse in them anyway
+    if (size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return 0;
+        }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, (writable) ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return 1;
+
+    void* data = MapViewOfFile(mapping, (writable) ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping alive
+    if (data == NULL)
+        return 1;
+
+    view->data = data;
+    view->size = (size_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            close(fd);
+            return 1;
+        }
+
+    // empty files can't be mapped, but there is nothing to parse in them anyway
+    if (st.st_size == 0)
+        {
+            close(fd);
+            return 0;
+        }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ | ((writable) ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid after closing the descriptor
+    if (data == MAP_FAILED)
+        return 1;
+
+#ifdef MADV_SEQUENTIAL
+    // parsing reads the file front to back, snapshots are used in any order
+    if (!writable) madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    view->data = data;
+    view->size = (size_t)st.st_size;
+#endif
+
+    return 0;
+}
+
+static void _unmap_file(FILE_VIEW* view)
+{
+    if (view->data == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(view->data);
+#else
+    munmap((void*)view->data, view->size);
+#endif
+
+    view->data = NULL;
+    view->size = 0;
+}
+
+// Arena functions
+static void _arena_init(PARSER_ARENA* arena)
+{
+    arena->blocks = NULL;
+    arena->block_count = 0;
+    arena->total_size = 0;
+}
+
+static void* _arena_alloc(PARSER_ARENA* arena, size_t size)
+{
+    // cells are aligned like a long double so they can be placed anywhere
+    PARSER_ARENA_BLOCK* block = arena->blocks;
+    if (block)
+        {
+            size_t aligned = (block->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+            block->used = (aligned < block->capacity) ? aligned : block->capacity;
+        }
+    return _arena_alloc_bytes(arena, size);
+}
+
+static void* _arena_alloc_bytes(PARSER_ARENA* arena, size_t size)
+{
+    PARSER_ARENA_BLOCK* block = arena->blocks;
+    if (block && block->capacity - block->used >= size)
+        {
+            void* result = (char*)block + ARENA_HEADER_SIZE + block->used;
+            block->used += size;
+            return result;
+        }
+
+    // big allocations get a block of their own behind the current one, so its free space isn't wasted
+    int dedicated = size > ARENA_BLOCK_SIZE / 4;
+    size_t capacity = (dedicated) ? size : ARENA_BLOCK_SIZE;
+
+    PARSER_ARENA_BLOCK* new_block = malloc(ARENA_HEADER_SIZE + capacity);
+    if (!new_block)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR ARENA BLOCK");
+            return NULL;
+        }
+    new_block->capacity = capacity;
+    new_block->used = size;
+
+    if (dedicated && block)
+        {
+            new_block->next = block->next;
+            block->next = new_block;
+        }
+    else
+        {
+            new_block->next = block;
+            arena->blocks = new_block;
+        }
+
+    arena->block_count++;
+    arena->total_size += capacity;
+    return (char*)new_block + ARENA_HEADER_SIZE;
+}
+
+static char* _arena_strndup(PARSER_ARENA* arena, const char* str, size_t length)
+{
+    char* copy = _arena_alloc_bytes(arena, length + 1);
+    if (!copy)
+        return NULL;
+
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+static CONTAINER_DATA* _arena_resize_row(PARSER_ARENA* arena, CONTAINER_DATA* row, size_t old_count, size_t new_count)
+{
+    // arena memory can't grow in place, the old row simply stays unused until the arena is freed
+    CONTAINER_DATA* new_row = _arena_alloc(arena, new_count * sizeof(CONTAINER_DATA));
+    if (!new_row)
+        return NULL;
+
+    memcpy(new_row, row, ((old_count < new_count) ? old_count : new_count) * sizeof(CONTAINER_DATA));
+    return new_row;
+}
+
+static void _arena_merge(PARSER_ARENA* arena, PARSER_ARENA* other)
+{
+    if (!other->blocks)
+        return;
+
+    // the current block of the target stays in front, so its free space can still be used
+    PARSER_ARENA_BLOCK* last = other->blocks;
+    while (last->next) last = last->next;
+
+    if (arena->blocks)
+        {
+            last->next = arena->blocks->next;
+            arena->blocks->next = other->blocks;
+        }
+    else arena->blocks = other->blocks;
+
+    arena->block_count += other->block_count;
+    arena->total_size += other->total_size;
+    _arena_init(other);
+}
+
+static void _arena_free(PARSER_ARENA* arena)
+{
+    PARSER_ARENA_BLOCK* block = arena->blocks;
+    while (block)
+        {
+            PARSER_ARENA_BLOCK* next = block->next;
+            free(block);
+            block = next;
+        }
+
+    _arena_init(arena);
+}
+
+// Dictionary functions
+static inline unsigned _hash_string(const char* str, size_t length)
+{
+    // FNV-1a
+    unsigned hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        {
+            hash ^= (unsigned char)str[i];
+            hash *= 16777619u;
+        }
+    return hash;
+}
+
+static int _string_table_add(STRING_TABLE* table, const char* str, size_t length, unsigned hash, PARSER_ARENA* arena, unsigned* code)
+{
+    // finds the code of a string or adds it: copied into the arena if one is given, taken as it is otherwise
+    if (table->disabled) return 1;
+    if ((table->count + 1) * 2 > table->slot_count && _string_table_grow(table))
+        return 1;
+
+    size_t mask = table->slot_count - 1;
+    size_t slot = hash & mask;
+    while (table->slots[slot])
+        {
+            unsigned found = table->slots[slot] - 1;
+            if (table->hashes[found] == hash && strncmp(table->values[found], str, length) == 0 && table->values[found][length] == '\0')
+                {
+                    *code = found;
+                    return 0;
+                }
+            slot = (slot + 1) & mask;
+        }
+
+    if (table->count >= DICTIONARY_MAX_SIZE)
+        {
+            _string_table_disable(table);
+            return 1;
+        }
+
+    if (table->count == table->capacity)
+        {
+            size_t new_capacity = (table->capacity) ? table->capacity : MIN_CAPACITY;
+            INCREASE_CAP(&new_capacity);
+            char** new_values = realloc(table->values, new_capacity * sizeof(char*));
+            if (new_values) table->values = new_values;
+            unsigned* new_hashes = realloc(table->hashes, new_capacity * sizeof(unsigned));
+            if (new_hashes) table->hashes = new_hashes;
+
+            if (!new_values || !new_hashes)
+                {
+                    _string_table_disable(table);
+                    return 1;
+                }
+            table->capacity = new_capacity;
+        }
+
+    char* value = (arena) ? _arena_strndup(arena, str, length) : (char*)str;
+    if (!value) return 1;
+
+    table->values[table->count] = value;
+    table->hashes[table->count] = hash;
+    table->slots[slot] = (unsigned)++table->count;
+    *code = (unsigned)(table->count - 1);
+    return 0;
+}
+
+static int _string_table_grow(STRING_TABLE* table)
+{
+    size_t slot_count = (table->slot_count) ? table->slot_count : STRING_TABLE_MIN_SLOTS;
+    while ((table->count + 1) * 2 > slot_count) INCREASE_CAP(&slot_count);
+
+    unsigned* slots = calloc(slot_count, sizeof(unsigned));
+    if (!slots)
+        {
+            _string_table_disable(table);
+            return 1;
+        }
+
+    size_t mask = slot_count - 1;
+    for (size_t code = 0; code < table->count; code++)
+        {
+            size_t slot = table->hashes[code] & mask;
+            while (slots[slot]) slot = (slot + 1) & mask;
+            slots[slot] = (unsigned)code + 1;
+        }
+
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+    return 0;
+}
+
+static void _string_table_disable(STRING_TABLE* table)
+{
+    // the strings themselves live in the arena, the cells keep using them
+    free(table->values);
+    free(table->hashes);
+    free(table->slots);
+    memset(table, 0, sizeof(STRING_TABLE));
+    table->disabled = 1;
+}
+
+static int _compare_dictionary_values(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int _compare_dictionary_values_nocase(const void* a, const void* b)
+{
+    return strcasecmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void _free_container_dictionaries(PARSER_CONTAINER* container)
+{
+    if (!container->dictionaries) return;
+
+    for (size_t j = 0; j < container->column_count; j++)
+        {
+            free(container->dictionaries[j].values);
+            free(container->dictionaries[j].folded);
+        }
+    free(container->dictionaries);
+    container->dictionaries = NULL;
+}
+
+static inline const PARSER_DICTIONARY* _column_dictionary(const PARSER_CONTAINER* container, size_t column)
+{
+    if (!container->dictionaries || container->dictionaries[column].count == 0)
+        return NULL;
+    return &container->dictionaries[column];
+}
+
+// Search functions
+static int _search_bound(PARSER* parser, const CONTAINER_DATA* value, int upper, size_t* row)
+{
+    // binary search over the sorted column with the comparison of the sort, so NULLs and the direction fall in place
+    if (!parser || !row || !parser->sorted)
+        {
+            PARSER_LOG_CRITICAL("CAN'T SEARCH, THE DATA ISN'T SORTED");
+            return 1;
+        }
+
+    const PARSER_CONTAINER* container = &parser->container;
+    size_t low = (container->header_included) ? 1 : 0;
+    size_t high = container->line_count;
+
+    // strcmp order is the code order of a dictionary, so the probe doesn't need a code
+    while (low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            CONTAINER_DATA cell = _get_cell(container, middle, parser->sorted_column);
+            int result = _compare_cells(&cell, value, &parser->sort_settings, NULL);
+            if (result < 0 || (upper && result == 0)) low = middle + 1;
+            else high = middle;
+        }
+
+    *row = low;
+    return 0;
+}
+
+// Index functions
+static uint64_t _hash_cell(const CONTAINER_DATA* cell)
+{
+    uint64_t hash;
+    switch (cell->type)
+        {
+            case INTEGER_TYPE:
+                hash = cell->value.integer;
+                break;
+            case FLOAT_TYPE:
+                {
+                    // equal values must hash the same: -0 is 0, every NaN is one key, padding bytes are left out
+                    bigfloat value = cell->value.floating;
+                    double as_double = (value != value) ? NAN : (value == 0) ? 0.0 : (double)value;
+                    memcpy(&hash, &as_double, sizeof(uint64_t));
+                }
+                break;
+            case STRING_TYPE:
+                hash = _hash_string(cell->value.string, strlen(cell->value.string));
+                break;
+            default:
+                hash = 0;
+                break;
+        }
+
+    // splitmix64 finalizer, so close integers don't end up in neighbouring slots
+    hash ^= (uint64_t)cell->type << 56;
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+static int _cells_equal(const CONTAINER_DATA* a, const CONTAINER_DATA* b)
+{
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type)
+        {
+            case INTEGER_TYPE: return a->value.integer == b->value.integer;
+            case FLOAT_TYPE:
+                return a->value.floating == b->value.floating
+                       || (a->value.floating != a->value.floating && b->value.floating != b->value.floating);
+            case STRING_TYPE: return strcmp(a->value.string, b->value.string) == 0;
+            case NULL_TYPE: return 1;
+            default: return 0;
+        }
+}
+
+static INDEX_SLOT* _index_find(const PARSER_INDEX* index, const PARSER_CONTAINER* container, const CONTAINER_DATA* key, uint64_t hash)
+{
+    // returns the slot of the key, or the empty slot where it would go
+    size_t mask = index->slot_count - 1;
+    size_t i = (size_t)hash & mask;
+    for (;;)
+        {
+            INDEX_SLOT* slot = &index->slots[i];
+            if (slot->count == 0) return slot;
+            if (slot->hash == hash)
+                {
+                    CONTAINER_DATA slot_key = _get_cell(container, slot->key_row, index->column);
+                    if (_cells_equal(&slot_key, key)) return slot;
+                }
+            i = (i + 1) & mask;
+        }
+}
+
+static int _update_indexes(PARSER* parser, const size_t* order, size_t count, size_t start_index)
+{
+    // order[i] is the old row that goes to start_index + i, the indexes only need the rows renamed
+    if (!parser->indexes)
+        return 0;
+
+    size_t* new_rows = malloc((count + start_index) * sizeof(size_t));
+    if (!new_rows)
+        return 1;
+    for (size_t i = 0; i < start_index; i++) new_rows[i] = i;
+    for (size_t i = 0; i < count; i++) new_rows[order[i]] = start_index + i;
+
+    for (PARSER_INDEX* index = parser->indexes; index; index = index->next)
+        {
+            for (size_t i = 0; i < count; i++) index->rows[i] = new_rows[index->rows[i]];
+            for (size_t i = 0; i < index->slot_count; i++)
+                {
+                    INDEX_SLOT* slot = &index->slots[i];
+                    if (slot->count == 0) continue;
+                    slot->key_row = new_rows[slot->key_row];
+                    if (slot->count > 1) qsort(index->rows + slot->first, slot->count, sizeof(size_t), _compare_row_numbers);
+                }
+        }
+
+    free(new_rows);
+    return 0;
+}
+
+static void _sort_update_indexes(PARSER* parser, const size_t* order, size_t count, size_t start_index)
+{
+    if (_update_indexes(parser, order, count, start_index))
+        {
+            PARSER_LOG_WARNING("FAILED TO UPDATE THE INDEXES, DROPPING THEM");
+            _free_indexes(parser);
+        }
+}
+
+static void _free_index(PARSER_INDEX* index)
+{
+    if (!index) return;
+    free(index->rows);
+    free(index->slots);
+    free(index);
+}
+
+static void _free_indexes(PARSER* parser)
+{
+    while (parser->indexes)
+        {
+            PARSER_INDEX* next = parser->indexes->next;
+            _free_index(parser->indexes);
+            parser->indexes = next;
+        }
+}
+
+static int _compare_row_numbers(const void* a, const void* b)
+{
+    size_t row_a = *(const size_t*)a;
+    size_t row_b = *(const size_t*)b;
+    return (row_a > row_b) - (row_a < row_b);
+}
+
+// Aggregation functions
+static int _group_table_init(GROUP_TABLE* table, const PARSER_CONTAINER* container, const size_t* columns, size_t column_count, const PARSER_AGGREGATION* aggregations, size_t aggregation_count)
+{
+    table->container = container;
+    table->columns = columns;
+    table->column_count = column_count;
+    table->aggregations = aggregations;
+    table->aggregation_count = aggregation_count;
+    table->slot_count = MIN_CAPACITY * 2;
+    table->group_count = 0;
+    table->group_capacity = MIN_CAPACITY;
+    table->slots = calloc(table->slot_count, sizeof(GROUP_SLOT));
+    table->rows = malloc(table->group_capacity * sizeof(size_t));
+    table->values = malloc(table->group_capacity * (aggregation_count > 0 ? aggregation_count : 1) * sizeof(AGGREGATE_VALUE));
+    if (!table->slots || !table->rows || !table->values)
+        {
+            _group_table_free(table);
+            return 1;
+        }
+    return 0;
+}
+
+static void _group_table_free(GROUP_TABLE* table)
+{
+    free(table->slots);
+    free(table->rows);
+    free(table->values);
+    table->slots = NULL;
+    table->rows = NULL;
+    table->values = NULL;
+}
+
+static uint64_t _group_hash(const GROUP_TABLE* table, size_t row)
+{
+    uint64_t hash = 0;
+    for (size_t i = 0; i < table->column_count; i++)
+        {
+            CONTAINER_DATA cell = _aggregate_cell(table->container, row, table->columns[i]);
+            hash = (hash ^ _hash_cell(&cell)) * 0x100000001b3ULL;
+        }
+    return hash ^ (hash >> 29);
+}
+
+static int _group_find(GROUP_TABLE* table, size_t row, uint64_t hash, size_t* group)
+{
+    // finds the group of the row, a row of a new group starts it
+    size_t mask = table->slot_count - 1;
+    size_t i = (size_t)hash & mask;
+    for (;; i = (i + 1) & mask)
+        {
+            GROUP_SLOT* slot = &table->slots[i];
+            if (slot->group == 0) break;
+            if (slot->hash != hash) continue;
+
+            size_t first_row = table->rows[slot->group - 1];
+            int equal = 1;
+            for (size_t k = 0; k < table->column_count && equal; k++)
+                {
+                    CONTAINER_DATA a = _aggregate_cell(table->container, first_row, table->columns[k]);
+                    CONTAINER_DATA b = _aggregate_cell(table->container, row, table->columns[k]);
+                    equal = _cells_equal(&a, &b);
+                }
+            if (equal)
+                {
+                    *group = slot->group - 1;
+                    return 0;
+                }
+        }
+
+    // the table is kept at most half full
+    if ((table->group_count + 1) * 2 > table->slot_count || table->group_count == table->group_capacity)
+        {
+            if (_group_table_grow(table)) return 1;
+            return _group_find(table, row, hash, group);
+        }
+
+    *group = table->group_count++;
+    table->slots[i].hash = hash;
+    table->slots[i].group = *group + 1;
+    table->rows[*group] = row;
+
+    AGGREGATE_VALUE* values = table->values + *group * table->aggregation_count;
+    for (size_t k = 0; k < table->aggregation_count; k++)
+        {
+            values[k].count = 0;
+            values[k].integer_sum = 0;
+            _set_null(&values[k].value);
+        }
+    return 0;
+}
+
+static int _group_table_grow(GROUP_TABLE* table)
+{
+    if (table->group_count == table->group_capacity)
+        {
+            size_t new_capacity = table->group_capacity;
+            INCREASE_CAP(&new_capacity);
+            size_t* new_rows = realloc(table->rows, new_capacity * sizeof(size_t));
+            if (new_rows) table->rows = new_rows;
+            AGGREGATE_VALUE* new_values = realloc(table->values, new_capacity * (table->aggregation_count > 0 ? table->aggregation_count : 1) * sizeof(AGGREGATE_VALUE));
+            if (new_values) table->values = new_values;
+            if (!new_rows || !new_values) return 1;
+            table->group_capacity = new_capacity;
+        }
+
+    if ((table->group_count + 1) * 2 > table->slot_count)
+        {
+            size_t new_count = table->slot_count;
+            INCREASE_CAP(&new_count);
+            GROUP_SLOT* new_slots = calloc(new_count, sizeof(GROUP_SLOT));
+            if (!new_slots) return 1;
+
+            // the hashes are kept in the slots, so the keys are never looked at again
+            for (size_t i = 0; i < table->slot_count; i++)
+                {
+                    if (table->slots[i].group == 0) continue;
+                    size_t j = (size_t)table->slots[i].hash & (new_count - 1);
+                    while (new_slots[j].group) j = (j + 1) & (new_count - 1);
+                    new_slots[j] = table->slots[i];
+                }
+            free(table->slots);
+            table->slots = new_slots;
+            table->slot_count = new_count;
+        }
+    return 0;
+}
+
+static int _aggregate_rows(GROUP_TABLE* table, size_t begin, size_t end)
+{
+    for (size_t row = begin; row < end; row++)
+        {
+            size_t group;
+            if (_group_find(table, row, _group_hash(table, row), &group))
+                return 1;
+
+            AGGREGATE_VALUE* values = table->values + group * table->aggregation_count;
+            for (size_t k = 0; k < table->aggregation_count; k++)
+                {
+                    CONTAINER_DATA cell = _aggregate_cell(table->container, row, table->aggregations[k].column);
+                    _aggregate_add(&values[k], table->aggregations[k].function, &cell);
+                }
+        }
+    return 0;
+}
+
+static int _aggregate_parallel(GROUP_TABLE* table, size_t begin, size_t end, size_t thread_count)
+{
+#ifdef FILEPARSER_NO_THREADS
+    (void)thread_count;
+    return _aggregate_rows(table, begin, end);
+#else
+    AGGREGATE_TASK* tasks = calloc(thread_count, sizeof(AGGREGATE_TASK));
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+    int* started = calloc(thread_count, sizeof(int));
+    if (!tasks || !threads || !started)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR AGGREGATION THREADS, AGGREGATING IN ONE THREAD");
+            free(tasks);
+            free(threads);
+            free(started);
+            return _aggregate_rows(table, begin, end);
+        }
+
+    // every thread aggregates its slice of the rows into its own table
+    size_t count = end - begin;
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            AGGREGATE_TASK* task = &tasks[i];
+            task->begin = begin + count / thread_count * i;
+            task->end = (i + 1 == thread_count) ? end : begin + count / thread_count * (i + 1);
+            task->result = _group_table_init(&task->table, table->container, table->columns, table->column_count, table->aggregations, table->aggregation_count);
+            if (task->result == 0)
+                started[i] = (pthread_create(&threads[i], NULL, _aggregate_task_run, task) == 0);
+        }
+
+    int result = 0;
+    for (size_t i = 0; i < thread_count; i++)
+        {
+            if (started[i]) pthread_join(threads[i], NULL);
+            else if (tasks[i].result == 0) _aggregate_task_run(&tasks[i]);
+            if (tasks[i].result) result = 1;
+        }
+
+    // partial tables are merged in slice order, so the groups keep the order they were first met in
+    for (size_t i = 0; i < thread_count && result == 0; i++)
+        {
+            const GROUP_TABLE* partial = &tasks[i].table;
+            for (size_t g = 0; g < partial->group_count && result == 0; g++)
+                {
+                    size_t group;
+                    result = _group_find(table, partial->rows[g], _group_hash(partial, partial->rows[g]), &group);
+                    for (size_t k = 0; k < table->aggregation_count && result == 0; k++)
+                        _aggregate_merge(&table->values[group * table->aggregation_count + k], table->aggregations[k].function, &partial->values[g * table->aggregation_count + k]);
+                }
+        }
+
+    PARSER_LOG_INFO("AGGREGATED %zu LINES IN %zu THREADS", count, thread_count);
+
+    for (size_t i = 0; i < thread_count; i++) _group_table_free(&tasks[i].table);
+    free(tasks);
+    free(threads);
+    free(started);
+    return result;
+#endif
+}
+
+#ifndef FILEPARSER_NO_THREADS
+static void* _aggregate_task_run(void* arg)
+{
+    AGGREGATE_TASK* task = arg;
+    task->result = _aggregate_rows(&task->table, task->begin, task->end);
+    return NULL;
+}
+#endif
+
+static void _aggregate_add(AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function, const CONTAINER_DATA* cell)
+{
+    if (cell->type == NULL_TYPE) return;
+    if (function == AGGREGATE_COUNT)
+        {
+            value->count++;
+            return;
+        }
+    if (cell->type != INTEGER_TYPE && cell->type != FLOAT_TYPE) return;
+
+    value->count++;
+    if (function == AGGREGATE_SUM || function == AGGREGATE_MEAN)
+        {
+            // integers are summed twice, the float sum is only used when floats are met (or for the mean)
+            bigfloat number = (cell->type == INTEGER_TYPE) ? (bigfloat)cell->value.integer : cell->value.floating;
+            if (cell->type == INTEGER_TYPE) value->integer_sum += cell->value.integer;
+            if (value->value.type == NULL_TYPE) value->value.value.floating = 0;
+            if (cell->type == FLOAT_TYPE || value->value.type == NULL_TYPE) value->value.type = cell->type;
+            value->value.value.floating += number;
+            return;
+        }
+
+    // NaNs are never the minimum or the maximum
+    if (cell->type == FLOAT_TYPE && cell->value.floating != cell->value.floating) return;
+    int order = (function == AGGREGATE_MIN) ? -1 : 1;
+    if (value->value.type == NULL_TYPE || _compare_numbers(cell, &value->value) == order) value->value = *cell;
+}
+
+#ifndef FILEPARSER_NO_THREADS
+static void _aggregate_merge(AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function, const AGGREGATE_VALUE* other)
+{
+    if (function == AGGREGATE_MIN || function == AGGREGATE_MAX)
+        {
+            // a tie keeps the earlier value, like the serial pass does
+            size_t count = value->count + other->count;
+            if (other->value.type != NULL_TYPE) _aggregate_add(value, function, &other->value);
+            value->count = count;
+            return;
+        }
+
+    value->count += other->count;
+    value->integer_sum += other->integer_sum;
+    if (other->value.type == NULL_TYPE) return;
+    if (value->value.type == NULL_TYPE) value->value = other->value;
+    else
+        {
+            if (other->value.type == FLOAT_TYPE) value->value.type = FLOAT_TYPE;
+            value->value.value.floating += other->value.value.floating;
+        }
+}
+#endif
+
+static CONTAINER_DATA _aggregate_result(const AGGREGATE_VALUE* value, AGGREGATE_FUNCTION function)
+{
+    // the value of a sum is FLOAT_TYPE once a float was added, INTEGER_TYPE while there were only integers
+    CONTAINER_DATA result;
+    _set_null(&result);
+
+    switch (function)
+        {
+            case AGGREGATE_COUNT:
+                result.type = INTEGER_TYPE;
+                result.value.integer = value->count;
+                break;
+            case AGGREGATE_SUM:
+                if (value->value.type == INTEGER_TYPE)
+                    {
+                        result.type = INTEGER_TYPE;
+                        result.value.integer = value->integer_sum;
+                    }
+                else result = value->value;
+                break;
+            case AGGREGATE_MIN:
+            case AGGREGATE_MAX:
+                result = value->value;
+                break;
+            case AGGREGATE_MEAN:
+                if (value->count == 0) break;
+                result.type = FLOAT_TYPE;
+                result.value.floating = value->value.value.floating / value->count;
+                break;
+        }
+    return result;
+}
+
+static inline int _compare_numbers(const CONTAINER_DATA* a, const CONTAINER_DATA* b)
+{
+    // integers compare as unsigned, like everywhere else in the library
+    if (a->type == INTEGER_TYPE && b->type == INTEGER_TYPE)
+        return (a->value.integer > b->value.integer) - (a->value.integer < b->value.integer);
+
+    bigfloat x = (a->type == INTEGER_TYPE) ? (bigfloat)a->value.integer : a->value.floating;
+    bigfloat y = (b->type == INTEGER_TYPE) ? (bigfloat)b->value.integer : b->value.floating;
+    return (x > y) - (x < y);
+}
+
+static CONTAINER_DATA _aggregate_cell(const PARSER_CONTAINER* container, size_t row, size_t column)
+{
+    CONTAINER_DATA cell;
+    if (row < container->line_count && column < _row_length(container, row))
+        return _get_cell(container, row, column);
+
+    _set_null(&cell);
+    return cell;
+}
+
+static int _fill_aggregate(PARSER* result, const PARSER* parser, const GROUP_TABLE* table)
+{
+    // the result is built as rows in its own arena, copying the strings of the group keys
+    const PARSER_CONTAINER* source = &parser->container;
+    PARSER_CONTAINER* container = &result->container;
+    size_t column_count = table->column_count + table->aggregation_count;
+    size_t header_included = source->header_included;
+    size_t line_count = table->group_count + header_included;
+
+    container->lines = malloc((line_count > 0 ? line_count : 1) * sizeof(CONTAINER_DATA*));
+    container->info = malloc((line_count > 0 ? line_count : 1) * sizeof(LINE_INFO));
+    if (!container->lines || !container->info)
+        return 1;
+    container->column_count = column_count;
+    container->header_included = (int)header_included;
+
+    static const char* function_names[] = {"count", "sum", "min", "max", "mean"};
+    for (size_t i = 0; i < line_count; i++)
+        {
+            CONTAINER_DATA* row = _arena_alloc(&result->arena, column_count * sizeof(CONTAINER_DATA));
+            if (!row)
+                return 1;
+            container->lines[i] = row;
+            container->info[i].token_count = column_count;
+            container->info[i].is_header = (i < header_included);
+            container->line_count = i + 1;
+
+            for (size_t j = 0; j < column_count; j++)
+                {
+                    CONTAINER_DATA cell;
+                    if (i < header_included && j >= table->column_count)
+                        {
+                            // aggregate columns are named after their function and source column, like "sum(price)"
+                            const PARSER_AGGREGATION* aggregation = &table->aggregations[j - table->column_count];
+                            CONTAINER_DATA name = _aggregate_cell(source, 0, aggregation->column);
+                            const char* column_name = (name.type == STRING_TYPE) ? name.value.string : "";
+                            size_t length = strlen(function_names[aggregation->function]) + strlen(column_name) + 3;
+                            cell.type = STRING_TYPE;
+                            cell.value.string = _arena_alloc_bytes(&result->arena, length);
+                            if (!cell.value.string)
+                                return 1;
+                            snprintf(cell.value.string, length, "%s(%s)", function_names[aggregation->function], column_name);
+                        }
+                    else if (j < table->column_count)
+                        {
+                            size_t source_row = (i < header_included) ? 0 : table->rows[i - header_included];
+                            cell = _aggregate_cell(source, source_row, table->columns[j]);
+                            if (cell.type == STRING_TYPE)
+                                {
+                                    // the result has no dictionaries, so the code of an encoded string is left behind
+                                    char* string = _arena_strndup(&result->arena, cell.value.string, strlen(cell.value.string));
+                                    if (!string)
+                                        return 1;
+                                    _set_null(&cell);
+                                    cell.type = STRING_TYPE;
+                                    cell.value.string = string;
+                                }
+                        }
+                    else
+                        {
+                            size_t k = j - table->column_count;
+                            cell = _aggregate_result(&table->values[(i - header_included) * table->aggregation_count + k], table->aggregations[k].function);
+                        }
+                    row[j] = cell;
+                }
+        }
+
+    if (result->settings.layout == COLUMNAR_LAYOUT && _convert_to_columnar(result))
+        PARSER_LOG_WARNING("KEEPING THE ROW LAYOUT");
+    return 0;
+}
+
+// Snapshot functions
+static int _snapshot_layout(const PARSER* parser, SNAPSHOT_HEADER* header, SNAPSHOT_COLUMN* columns)
+{
+    const PARSER_CONTAINER* container = &parser->container;
+    size_t column_count = container->column_count;
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = container->line_count - start_index;
+
+    memset(header, 0, sizeof(SNAPSHOT_HEADER));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+    header->size_of_offset = sizeof(size_t);
+    header->size_of_code = sizeof(unsigned);
+    header->size_of_value = sizeof(DATA_VAR);
+    header->float_digits = LDBL_MANT_DIG;
+    header->line_count = container->line_count;
+    header->column_count = column_count;
+    header->header_included = (uint32_t)start_index;
+    header->sorted = (uint32_t)parser->sorted;
+    header->sorted_column = parser->sorted_column;
+    header->sort_direction = (parser->sort_settings.direction == DESCENDING);
+    header->case_sensitive = (uint32_t)parser->sort_settings.case_sensitive;
+
+    // first pass: finding out the type of every column and the size of the string heap
+    unsigned* seen_types = calloc(column_count > 0 ? column_count : 1, sizeof(unsigned));
+    if (!seen_types)
+        return 1;
+
+    uint64_t heap_size = 0;
+    for (size_t i = 0; i < container->line_count; i++)
+        for (size_t j = 0; j < column_count; j++)
+            {
+                CONTAINER_DATA cell = _get_cell(container, i, j);
+                if (cell.type == STRING_TYPE && (i < start_index || !_column_dictionary(container, j)))
+                    heap_size += strlen(cell.value.string) + 1;
+                if (i >= start_index) seen_types[j] |= 1u << cell.type;
+            }
+
+    uint64_t offset = _snapshot_align(sizeof(SNAPSHOT_HEADER));
+    header->columns_offset = offset;
+    offset = _snapshot_align(offset + column_count * sizeof(SNAPSHOT_COLUMN));
+    if (start_index)
+        {
+            header->header_offset = offset;
+            offset = _snapshot_align(offset + column_count * sizeof(SNAPSHOT_CELL));
+        }
+    if (container->schema)
+        {
+            header->schema_offset = offset;
+            offset = _snapshot_align(offset + column_count * sizeof(SNAPSHOT_SCHEMA));
+        }
+
+    size_t bitmap_size = (data_count + 7) / 8;
+    for (size_t j = 0; j < column_count; j++)
+        {
+            SNAPSHOT_COLUMN* column = &columns[j];
+            const PARSER_DICTIONARY* dictionary = _column_dictionary(container, j);
+            unsigned value_types = seen_types[j] & ~(1u << NULL_TYPE);
+
+            column->mixed = (value_types & (value_types - 1)) != 0;
+            column->type = (value_types == 0) ? NULL_TYPE
+                           : (value_types == (1u << INTEGER_TYPE)) ? INTEGER_TYPE
+                           : (value_types == (1u << FLOAT_TYPE)) ? FLOAT_TYPE : STRING_TYPE;
+            column->dictionary_count = (dictionary) ? dictionary->count : 0;
+
+            column->nulls_offset = offset;
+            offset = _snapshot_align(offset + bitmap_size);
+            if (column->mixed)
+                {
+                    column->types_offset = offset;
+                    offset = _snapshot_align(offset + data_count);
+                }
+            if (_snapshot_element_size(column))
+                {
+                    column->values_offset = offset;
+                    offset = _snapshot_align(offset + data_count * _snapshot_element_size(column));
+                }
+            if (dictionary)
+                {
+                    column->dictionary_offset = offset;
+                    offset = _snapshot_align(offset + dictionary->count * sizeof(uint64_t));
+                    column->folded_offset = offset;
+                    offset = _snapshot_align(offset + dictionary->count * sizeof(unsigned));
+                    for (size_t code = 0; code < dictionary->count; code++)
+                        heap_size += strlen(dictionary->values[code]) + 1;
+                }
+        }
+
+    free(seen_types);
+
+    header->heap_offset = offset;
+    header->heap_size = heap_size;
+    header->file_size = offset + heap_size;
+    return 0;
+}
+
+static void _snapshot_write(const PARSER_CONTAINER* container, const SNAPSHOT_HEADER* header, const SNAPSHOT_COLUMN* columns, OUTPUT_BUFFER* output)
+{
+    size_t column_count = container->column_count;
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = container->line_count - start_index;
+    uint64_t position = 0;
+
+    _snapshot_put(output, &position, header, sizeof(SNAPSHOT_HEADER));
+    _snapshot_pad(output, &position, header->columns_offset);
+    _snapshot_put(output, &position, columns, column_count * sizeof(SNAPSHOT_COLUMN));
+
+    // the heap holds the header strings, then the dictionaries, then the strings of the columns
+    uint64_t dictionary_used = 0;
+    if (header->header_offset)
+        {
+            _snapshot_pad(output, &position, header->header_offset);
+            for (size_t j = 0; j < column_count; j++)
+                {
+                    CONTAINER_DATA cell = _get_cell(container, 0, j);
+                    SNAPSHOT_CELL stored;
+                    memset(&stored, 0, sizeof(SNAPSHOT_CELL));
+                    stored.type = cell.type;
+                    if (cell.type == STRING_TYPE)
+                        {
+                            stored.value.integer = dictionary_used;
+                            dictionary_used += strlen(cell.value.string) + 1;
+                        }
+                    else if (cell.type == INTEGER_TYPE) stored.value.integer = cell.value.integer;
+                    else if (cell.type == FLOAT_TYPE) stored.value.floating = cell.value.floating;
+                    _snapshot_put(output, &position, &stored, sizeof(SNAPSHOT_CELL));
+                }
+        }
+
+    uint64_t heap_used = dictionary_used;
+    for (size_t j = 0; j < column_count; j++)
+        {
+            const PARSER_DICTIONARY* dictionary = _column_dictionary(container, j);
+            for (size_t code = 0; dictionary && code < dictionary->count; code++)
+                heap_used += strlen(dictionary->values[code]) + 1;
+        }
+
+    if (header->schema_offset)
+        {
+            _snapshot_pad(output, &position, header->schema_offset);
+            for (size_t j = 0; j < column_count; j++)
+                {
+                    SNAPSHOT_SCHEMA stored;
+                    stored.type = container->schema[j].type;
+                    stored.nullable = (uint32_t)container->schema[j].nullable;
+                    _snapshot_put(output, &position, &stored, sizeof(SNAPSHOT_SCHEMA));
+                }
+        }
+
+    for (size_t j = 0; j < column_count; j++)
+        {
+            const SNAPSHOT_COLUMN* column = &columns[j];
+            const PARSER_DICTIONARY* dictionary = _column_dictionary(container, j);
+
+            // NULL bitmap, eight cells a byte
+            _snapshot_pad(output, &position, column->nulls_offset);
+            unsigned char bits = 0;
+            for (size_t row = 0; row < data_count; row++)
+                {
+                    if (_get_cell(container, start_index + row, j).type == NULL_TYPE) bits |= (unsigned char)(1u << (row & 7));
+                    if ((row & 7) == 7 || row + 1 == data_count)
+                        {
+                            _snapshot_put(output, &position, &bits, 1);
+                            bits = 0;
+                        }
+                }
+
+            if (column->mixed)
+                {
+                    _snapshot_pad(output, &position, column->types_offset);
+                    for (size_t row = 0; row < data_count; row++)
+                        {
+                            unsigned char type = (unsigned char)_get_cell(container, start_index + row, j).type;
+                            _snapshot_put(output, &position, &type, 1);
+                        }
+                }
+
+            if (column->values_offset)
+                {
+                    _snapshot_pad(output, &position, column->values_offset);
+                    for (size_t row = 0; row < data_count; row++)
+                        {
+                            CONTAINER_DATA cell = _get_cell(container, start_index + row, j);
+                            DATA_VAR value;
+                            memset(&value, 0, sizeof(DATA_VAR));
+                            if (cell.type == STRING_TYPE)
+                                {
+                                    if (dictionary) value.integer = cell.value.coded.code;
+                                    else
+                                        {
+                                            value.integer = heap_used;
+                                            heap_used += strlen(cell.value.string) + 1;
+                                        }
+                                }
+                            else if (cell.type == INTEGER_TYPE) value.integer = cell.value.integer;
+                            else if (cell.type == FLOAT_TYPE) value.floating = cell.value.floating; // keeps the padding of long double zeroed
+
+                            if (column->mixed) _snapshot_put(output, &position, &value, sizeof(DATA_VAR));
+                            else if (column->type == INTEGER_TYPE) _snapshot_put(output, &position, &value.integer, sizeof(ull));
+                            else if (column->type == FLOAT_TYPE) _snapshot_put(output, &position, &value.floating, sizeof(bigfloat));
+                            else if (dictionary)
+                                {
+                                    unsigned code = (unsigned)value.integer;
+                                    _snapshot_put(output, &position, &code, sizeof(unsigned));
+                                }
+                            else
+                                {
+                                    size_t heap_offset = (size_t)value.integer;
+                                    _snapshot_put(output, &position, &heap_offset, sizeof(size_t));
+                                }
+                        }
+                }
+
+            if (dictionary)
+                {
+                    _snapshot_pad(output, &position, column->dictionary_offset);
+                    for (size_t code = 0; code < dictionary->count; code++)
+                        {
+                            _snapshot_put(output, &position, &dictionary_used, sizeof(uint64_t));
+                            dictionary_used += strlen(dictionary->values[code]) + 1;
+                        }
+                    _snapshot_pad(output, &position, column->folded_offset);
+                    _snapshot_put(output, &position, dictionary->folded, dictionary->count * sizeof(unsigned));
+                }
+        }
+
+    // the strings go in the order their offsets were given out above
+    _snapshot_pad(output, &position, header->heap_offset);
+    for (size_t j = 0; start_index && j < column_count; j++)
+        {
+            CONTAINER_DATA cell = _get_cell(container, 0, j);
+            if (cell.type == STRING_TYPE) _snapshot_put(output, &position, cell.value.string, strlen(cell.value.string) + 1);
+        }
+    for (size_t j = 0; j < column_count; j++)
+        {
+            const PARSER_DICTIONARY* dictionary = _column_dictionary(container, j);
+            for (size_t code = 0; dictionary && code < dictionary->count; code++)
+                _snapshot_put(output, &position, dictionary->values[code], strlen(dictionary->values[code]) + 1);
+        }
+    for (size_t j = 0; j < column_count; j++)
+        {
+            if (_column_dictionary(container, j)) continue;
+            for (size_t row = 0; row < data_count; row++)
+                {
+                    CONTAINER_DATA cell = _get_cell(container, start_index + row, j);
+                    if (cell.type == STRING_TYPE) _snapshot_put(output, &position, cell.value.string, strlen(cell.value.string) + 1);
+                }
+        }
+
+    if (position != header->file_size)
+        {
+            PARSER_LOG_CRITICAL("SNAPSHOT SIZE MISMATCH [%llu INSTEAD OF %llu BYTES]", (ull)position, (ull)header->file_size);
+            output->failed = 1;
+        }
+}
+
+static inline void _snapshot_put(OUTPUT_BUFFER* output, uint64_t* position, const void* data, size_t size)
+{
+    _output_write(output, (const char*)data, size);
+    *position += size;
+}
+
+static void _snapshot_pad(OUTPUT_BUFFER* output, uint64_t* position, uint64_t offset)
+{
+    static const char zeros[SNAPSHOT_ALIGNMENT] = {0};
+    while (*position < offset)
+        {
+            size_t size = (offset - *position < SNAPSHOT_ALIGNMENT) ? (size_t)(offset - *position) : SNAPSHOT_ALIGNMENT;
+            _snapshot_put(output, position, zeros, size);
+        }
+}
+
+static inline uint64_t _snapshot_align(uint64_t offset)
+{
+    return (offset + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+static inline size_t _snapshot_element_size(const SNAPSHOT_COLUMN* column)
+{
+    if (column->mixed) return sizeof(DATA_VAR);
+    switch (column->type)
+        {
+            case INTEGER_TYPE: return sizeof(ull);
+            case FLOAT_TYPE: return sizeof(bigfloat);
+            case STRING_TYPE: return (column->dictionary_count) ? sizeof(unsigned) : sizeof(size_t);
+            default: return 0;
+        }
+}
+
+static int _snapshot_check(const SNAPSHOT_HEADER* header, size_t size)
+{
+    if (size < sizeof(SNAPSHOT_HEADER) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+        return 1;
+
+    if (header->version != SNAPSHOT_VERSION)
+        {
+            PARSER_LOG_CRITICAL("UNSUPPORTED SNAPSHOT VERSION %u [EXPECTED %u]", (unsigned)header->version, SNAPSHOT_VERSION);
+            return 1;
+        }
+
+    if (header->byte_order != SNAPSHOT_BYTE_ORDER || header->size_of_offset != sizeof(size_t) || header->size_of_code != sizeof(unsigned)
+            || header->size_of_value != sizeof(DATA_VAR) || header->float_digits != LDBL_MANT_DIG)
+        {
+            PARSER_LOG_CRITICAL("THE SNAPSHOT WAS WRITTEN ON AN INCOMPATIBLE PLATFORM");
+            return 1;
+        }
+
+    if (header->file_size != size)
+        {
+            PARSER_LOG_CRITICAL("THE SNAPSHOT IS TRUNCATED [%zu OF %llu BYTES]", size, (ull)header->file_size);
+            return 1;
+        }
+
+    uint64_t column_count = header->column_count;
+    if (header->line_count < header->header_included || (header->sorted && header->sorted_column >= column_count)
+            || _snapshot_array_fits(size, header->columns_offset, column_count, sizeof(SNAPSHOT_COLUMN))
+            || (header->header_offset && _snapshot_array_fits(size, header->header_offset, column_count, sizeof(SNAPSHOT_CELL)))
+            || (header->schema_offset && _snapshot_array_fits(size, header->schema_offset, column_count, sizeof(SNAPSHOT_SCHEMA)))
+            || (header->header_included && !header->header_offset)
+            || _snapshot_array_fits(size, header->heap_offset, header->heap_size, 1))
+        return 1;
+
+    // every string offset below the heap size ends inside the heap
+    if (header->heap_size > 0 && ((const char*)header)[header->heap_offset + header->heap_size - 1] != '\0')
+        return 1;
+
+    return 0;
+}
+
+static int _snapshot_array_fits(size_t size, uint64_t offset, uint64_t count, size_t element_size)
+{
+    // returns 1 when the array is misaligned or doesn't fit into the file
+    if (offset % SNAPSHOT_ALIGNMENT != 0 || offset > size) return 1;
+    return element_size > 0 && count > (size - offset) / element_size;
+}
+
+static int _snapshot_check_values(const PARSER_COLUMN* column, size_t data_count, size_t heap_size)
+{
+    // returns 1 when a type, heap offset or code of the column points outside of the snapshot;
+    // numbers can hold any bits, so only string and mixed columns are read
+    const PARSER_DICTIONARY* dictionary = column->dictionary;
+    if (dictionary)
+        for (size_t code = 0; code < dictionary->count; code++)
+            if (dictionary->folded[code] >= dictionary->count) return 1;
+
+    if (!column->types && column->type != STRING_TYPE)
+        return 0;
+
+    for (size_t row = 0; row < data_count; row++)
+        {
+            uint64_t value;
+            if (column->types)
+                {
+                    if (column->types[row] > NULL_TYPE) return 1;
+                    if (column->types[row] != STRING_TYPE) continue;
+                    value = column->values.mixed[row].integer;
+                }
+            else if (PARSER_COLUMN_IS_NULL(column, row)) continue;
+            else value = (dictionary) ? column->values.codes[row] : column->values.offsets[row];
+
+            if (value >= ((dictionary) ? dictionary->count : heap_size)) return 1;
+        }
+
+    return 0;
+}
+
+static int _snapshot_attach(const FILE_VIEW* view, PARSER_CONTAINER* container, PARSER_ARENA* arena)
+{
+    // only the small tables are copied, every column array stays in the mapping
+    const char* base = view->data;
+    const SNAPSHOT_HEADER* header = (const SNAPSHOT_HEADER*)base;
+    const SNAPSHOT_COLUMN* stored = (const SNAPSHOT_COLUMN*)(base + header->columns_offset);
+    size_t column_count = (size_t)header->column_count;
+    size_t start_index = header->header_included ? 1 : 0;
+    size_t data_count = (size_t)header->line_count - start_index;
+    size_t bitmap_size = (data_count + 7) / 8;
+    char* heap = (char*)base + header->heap_offset;
+    uint64_t heap_size = header->heap_size;
+
+    container->line_count = (size_t)header->line_count;
+    container->column_count = column_count;
+    container->header_included = (int)start_index;
+    container->layout = COLUMNAR_LAYOUT;
+    container->string_heap = heap;
+    container->string_heap_size = (size_t)heap_size;
+    container->columns = _arena_alloc(arena, (column_count > 0 ? column_count : 1) * sizeof(PARSER_COLUMN));
+    container->header = (start_index) ? _arena_alloc(arena, column_count * sizeof(CONTAINER_DATA)) : NULL;
+    if (!container->columns || (start_index && !container->header))
+        return 1;
+
+    for (size_t j = 0; j < column_count; j++)
+        {
+            const SNAPSHOT_COLUMN* source = &stored[j];
+            PARSER_COLUMN* column = &container->columns[j];
+            size_t element_size = _snapshot_element_size(source);
+
+            if (source->type > NULL_TYPE || (source->mixed && source->type != STRING_TYPE)
+                    || _snapshot_array_fits(view->size, source->nulls_offset, bitmap_size, 1)
+                    || (source->mixed && _snapshot_array_fits(view->size, source->types_offset, data_count, 1))
+                    || (element_size && _snapshot_array_fits(view->size, source->values_offset, data_count, element_size))
+                    || (source->dictionary_count && (_snapshot_array_fits(view->size, source->dictionary_offset, source->dictionary_count, sizeof(uint64_t))
+                            || _snapshot_array_fits(view->size, source->folded_offset, source->dictionary_count, sizeof(unsigned)))))
+                return 1;
+
+            column->type = (DATA_TYPE)source->type;
+            column->nulls = (unsigned char*)base + source->nulls_offset;
+            column->types = (source->mixed) ? (unsigned char*)base + source->types_offset : NULL;
+            column->values.integers = (element_size) ? (ull*)(base + source->values_offset) : NULL;
+            column->dictionary = NULL;
+
+            if (source->dictionary_count == 0) continue;
+
+            if (!container->dictionaries)
+                {
+                    container->dictionaries = calloc(column_count, sizeof(PARSER_DICTIONARY));
+                    if (!container->dictionaries) return 1;
+                }
+
+            PARSER_DICTIONARY* dictionary = &container->dictionaries[j];
+            size_t count = (size_t)source->dictionary_count;
+            dictionary->values = malloc(count * sizeof(char*));
+            dictionary->folded = malloc(count * sizeof(unsigned));
+            if (!dictionary->values || !dictionary->folded) return 1;
+
+            const uint64_t* offsets = (const uint64_t*)(base + source->dictionary_offset);
+            for (size_t code = 0; code < count; code++)
+                {
+                    if (offsets[code] >= heap_size) return 1;
+                    dictionary->values[code] = heap + offsets[code];
+                }
+            memcpy(dictionary->folded, base + source->folded_offset, count * sizeof(unsigned));
+            dictionary->count = count;
+            column->dictionary = dictionary;
+        }
+
+    for (size_t j = 0; j < column_count; j++)
+        if (_snapshot_check_values(&container->columns[j], data_count, (size_t)heap_size)) return 1;
+
+    const SNAPSHOT_CELL* header_cells = (const SNAPSHOT_CELL*)(base + header->header_offset);
+    for (size_t j = 0; start_index && j < column_count; j++)
+        {
+            CONTAINER_DATA* cell = &container->header[j];
+            cell->type = (DATA_TYPE)header_cells[j].type;
+            cell->value = header_cells[j].value;
+            if (cell->type > NULL_TYPE || (cell->type == STRING_TYPE && cell->value.integer >= heap_size)) return 1;
+            if (cell->type == STRING_TYPE) cell->value.string = heap + header_cells[j].value.integer;
+        }
+
+    if (header->schema_offset)
+        {
+            const SNAPSHOT_SCHEMA* schema = (const SNAPSHOT_SCHEMA*)(base + header->schema_offset);
+            container->schema = malloc((column_count > 0 ? column_count : 1) * sizeof(PARSER_SCHEMA_COLUMN));
+            if (!container->schema) return 1;
+            for (size_t j = 0; j < column_count; j++)
+                {
+                    if (schema[j].type > NULL_TYPE) return 1;
+                    container->schema[j].type = (DATA_TYPE)schema[j].type;
+                    container->schema[j].nullable = (int)schema[j].nullable;
+                }
+        }
+
+    return 0;
+}
+
+// Layout functions
+static inline void _materialize_cell(PARSER_ARENA* arena, CONTAINER_DATA* cell)
+{
+    if (cell->type != RAW_TYPE) return;
+
+    const char* token = cell->value.raw.data;
+    size_t length = cell->value.raw.length;
+    _classify_token(&token, &length, cell, 0);
+
+    if (cell->type == STRING_TYPE)
+        {
+            cell->value.string = _arena_strndup(arena, token, length);
+            if (!cell->value.string) _set_null(cell);
+        }
+}
+
+static void _materialize_row(PARSER* parser, size_t row)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    if (container->layout != ROW_LAYOUT) return;
+
+    for (size_t i = 0; i < container->info[row].token_count; i++)
+        _materialize_cell(&parser->arena, &container->lines[row][i]);
+}
+
+static void _materialize_column(PARSER* parser, size_t column)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    if (container->layout != ROW_LAYOUT) return;
+
+    for (size_t i = 0; i < container->line_count; i++)
+        if (column < container->info[i].token_count)
+            _materialize_cell(&parser->arena, &container->lines[i][column]);
+}
+
+static CONTAINER_DATA _get_cell(const PARSER_CONTAINER* container, size_t row, size_t column)
+{
+    if (container->layout == ROW_LAYOUT)
+        return container->lines[row][column];
+
+    if (container->header_included)
+        {
+            if (row == 0) return container->header[column];
+            row--;
+        }
+
+    const PARSER_COLUMN* current_column = &container->columns[column];
+    DATA_TYPE type = (current_column->types) ? (DATA_TYPE)current_column->types[row]
+                     : (PARSER_COLUMN_IS_NULL(current_column, row)) ? NULL_TYPE : current_column->type;
+
+    CONTAINER_DATA cell;
+    cell.type = type;
+    switch (type)
+        {
+            case STRING_TYPE:
+                if (current_column->dictionary)
+                    {
+                        unsigned code = (current_column->types) ? (unsigned)current_column->values.mixed[row].integer
+                                        : current_column->values.codes[row];
+                        cell.value.coded.string = current_column->dictionary->values[code];
+                        cell.value.coded.code = code;
+                    }
+                else cell.value.string = container->string_heap + ((current_column->types)
+                                         ? (size_t)current_column->values.mixed[row].integer
+                                         : current_column->values.offsets[row]);
+                break;
+            case INTEGER_TYPE:
+                cell.value.integer = (current_column->types) ? current_column->values.mixed[row].integer
+                                     : current_column->values.integers[row];
+                break;
+            case FLOAT_TYPE:
+                cell.value.floating = (current_column->types) ? current_column->values.mixed[row].floating
+                                      : current_column->values.floats[row];
+                break;
+            case NULL_TYPE:
+            case RAW_TYPE: // columns are always typed
+                cell.value.null = NULL;
+                break;
+        }
+
+    return cell;
+}
+
+static inline size_t _row_length(const PARSER_CONTAINER* container, size_t row)
+{
+    return (container->layout == ROW_LAYOUT) ? container->info[row].token_count : container->column_count;
+}
+
+static int _convert_to_columnar(PARSER* parser)
+{
+    PARSER_CONTAINER* container = &parser->container;
+    size_t column_count = container->column_count;
+    size_t start_index = (container->header_included) ? 1 : 0;
+    size_t data_count = container->line_count - start_index;
+    size_t bitmap_size = (data_count + 7) / 8;
+
+    // first pass: finding out the type of every column and the size of the string heap
+    unsigned* seen_types = calloc(column_count, sizeof(unsigned));
+    if (!seen_types)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING COLUMNAR CONVERSION");
+            return 1;
+        }
+
+    // encoded columns keep every distinct string in the heap once
+    size_t heap_size = 0;
+    for (size_t j = 0; j < column_count; j++)
+        {
+            const PARSER_DICTIONARY* dictionary = _column_dictionary(container, j);
+            for (size_t code = 0; dictionary && code < dictionary->count; code++)
+                heap_size += strlen(dictionary->values[code]) + 1;
+        }
+
+    for (size_t i = 0; i < container->line_count; i++)
+        for (size_t j = 0; j < column_count; j++)
+            {
+                CONTAINER_DATA* cell = &container->lines[i][j];
+                if (cell->type == STRING_TYPE && (i < start_index || !_column_dictionary(container, j)))
+                    heap_size += strlen(cell->value.string) + 1;
+                if (i >= start_index) seen_types[j] |= 1u << cell->type;
+            }
+
+    // everything columnar goes to a new arena, the old one with all the rows is dropped afterwards
+    PARSER_ARENA arena;
+    _arena_init(&arena);
+
+    PARSER_COLUMN* columns = _arena_alloc(&arena, (column_count > 0 ? column_count : 1) * sizeof(PARSER_COLUMN));
+    char* heap = _arena_alloc_bytes(&arena, heap_size > 0 ? heap_size : 1);
+    CONTAINER_DATA* header = (start_index) ? _arena_alloc(&arena, column_count * sizeof(CONTAINER_DATA)) : NULL;
+    int failed = !columns || !heap || (start_index && !header);
+
+    for (size_t j = 0; j < column_count && !failed; j++)
+        {
+            PARSER_COLUMN* column = &columns[j];
+            unsigned value_types = seen_types[j] & ~(1u << NULL_TYPE);
+
+            column->types = NULL;
+            column->values.integers = NULL;
+            column->dictionary = _column_dictionary(container, j);
+            column->nulls = _arena_alloc_bytes(&arena, bitmap_size > 0 ? bitmap_size : 1);
+            if (column->nulls) memset(column->nulls, 0, bitmap_size);
+
+            if (value_types == 0)
+                column->type = NULL_TYPE;
+            else if ((value_types & (value_types - 1)) == 0) // only one type besides NULL
+                {
+                    column->type = (value_types == (1u << INTEGER_TYPE)) ? INTEGER_TYPE
+                                   : (value_types == (1u << FLOAT_TYPE)) ? FLOAT_TYPE : STRING_TYPE;
+                    size_t element_size = (column->type == INTEGER_TYPE) ? sizeof(ull)
+                                          : (column->type == FLOAT_TYPE) ? sizeof(bigfloat)
+                                          : (column->dictionary) ? sizeof(unsigned) : sizeof(size_t);
+                    column->values.integers = _arena_alloc(&arena, data_count * element_size + 1);
+                    failed |= column->values.integers == NULL;
+                }
+            else
+                {
+                    column->type = STRING_TYPE;
+                    column->types = _arena_alloc_bytes(&arena, data_count + 1);
+                    column->values.mixed = _arena_alloc(&arena, data_count * sizeof(DATA_VAR) + 1);
+                    failed |= !column->types || !column->values.mixed;
+                }
+            failed |= column->nulls == NULL;
+        }
+
+    free(seen_types);
+
+    if (failed)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING COLUMNAR CONVERSION");
+            _arena_free(&arena);
+            return 1;
+        }
+
+    // the dictionaries move to the heap too, the old arena is about to be dropped
+    size_t heap_used = 0;
+    for (size_t j = 0; j < column_count; j++)
+        {
+            PARSER_DICTIONARY* dictionary = (columns[j].dictionary) ? &container->dictionaries[j] : NULL;
+            for (size_t code = 0; dictionary && code < dictionary->count; code++)
+                {
+                    size_t length = strlen(dictionary->values[code]) + 1;
+                    memcpy(heap + heap_used, dictionary->values[code], length);
+                    dictionary->values[code] = heap + heap_used;
+                    heap_used += length;
+                }
+        }
+
+    // second pass: filling the columns
+    for (size_t i = 0; i < container->line_count; i++)
+        for (size_t j = 0; j < column_count; j++)
+            {
+                CONTAINER_DATA* cell = &container->lines[i][j];
+                const PARSER_DICTIONARY* dictionary = (i < start_index) ? NULL : columns[j].dictionary;
+                size_t offset = heap_used;
+                if (cell->type == STRING_TYPE && !dictionary)
+                    {
+                        size_t length = strlen(cell->value.string) + 1;
+                        memcpy(heap + heap_used, cell->value.string, length);
+                        heap_used += length;
+                    }
+
+                if (i < start_index)
+                    {
+                        header[j] = *cell;
+                        if (cell->type == STRING_TYPE) header[j].value.string = heap + offset;
+                        continue;
+                    }
+
+                size_t row = i - start_index;
+                PARSER_COLUMN* column = &columns[j];
+                if (cell->type == NULL_TYPE) column->nulls[row >> 3] |= (unsigned char)(1u << (row & 7));
+
+                if (column->types)
+                    {
+                        column->types[row] = (unsigned char)cell->type;
+                        if (cell->type == STRING_TYPE) column->values.mixed[row].integer = (dictionary) ? cell->value.coded.code : offset;
+                        else column->values.mixed[row] = cell->value;
+                        continue;
+                    }
+
+                switch (cell->type)
+                    {
+                        case INTEGER_TYPE:
+                            column->values.integers[row] = cell->value.integer;
+                            break;
+                        case FLOAT_TYPE:
+                            column->values.floats[row] = cell->value.floating;
+                            break;
+                        case STRING_TYPE:
+                            if (dictionary) column->values.codes[row] = cell->value.coded.code;
+                            else column->values.offsets[row] = offset;
+                            break;
+                        case NULL_TYPE:
+                        case RAW_TYPE:
+                            if (column->type == INTEGER_TYPE) column->values.integers[row] = 0;
+                            else if (column->type == FLOAT_TYPE) column->values.floats[row] = 0;
+                            else if (dictionary) column->values.codes[row] = 0;
+                            else if (column->type == STRING_TYPE) column->values.offsets[row] = 0;
+                            break;
+                    }
+            }
+
+    free(container->lines);
+    free(container->info);
+    _arena_free(&parser->arena);
+
+    parser->arena = arena;
+    container->lines = NULL;
+    container->info = NULL;
+    container->layout = COLUMNAR_LAYOUT;
+    container->columns = columns;
+    container->header = header;
+    container->string_heap = heap;
+    container->string_heap_size = heap_size;
+
+    PARSER_LOG_INFO("CONVERTED %zu LINES TO %zu COLUMNS", data_count, column_count);
+    return 0;
+}
+
+static int _permute_columns(PARSER_CONTAINER* container, const size_t* order, size_t count)
+{
+    // order[i] is the old position of the line that goes to the position i
+    size_t bitmap_size = (count + 7) / 8;
+    size_t max_element = sizeof(DATA_VAR) > sizeof(bigfloat) ? sizeof(DATA_VAR) : sizeof(bigfloat);
+    unsigned char* buffer = malloc(count * max_element + bitmap_size + 1);
+    if (!buffer)
+        {
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED DURING SORT");
+            return 1;
+        }
+
+    for (size_t j = 0; j < container->column_count; j++)
+        {
+            PARSER_COLUMN* column = &container->columns[j];
+
+            memset(buffer, 0, bitmap_size);
+            for (size_t i = 0; i < count; i++)
+                if (PARSER_COLUMN_IS_NULL(column, order[i]))
+                    buffer[i >> 3] |= (unsigned char)(1u << (i & 7));
+            memcpy(column->nulls, buffer, bitmap_size);
+
+            if (column->types)
+                {
+                    for (size_t i = 0; i < count; i++) buffer[i] = column->types[order[i]];
+                    memcpy(column->types, buffer, count);
+
+                    DATA_VAR* values = (DATA_VAR*)buffer;
+                    for (size_t i = 0; i < count; i++) values[i] = column->values.mixed[order[i]];
+                    memcpy(column->values.mixed, values, count * sizeof(DATA_VAR));
+                }
+            else if (column->type == INTEGER_TYPE)
+                {
+                    ull* values = (ull*)buffer;
+                    for (size_t i = 0; i < count; i++) values[i] = column->values.integers[order[i]];
+                    memcpy(column->values.integers, values, count * sizeof(ull));
+                }
+            else if (column->type == FLOAT_TYPE)
+                {
+                    bigfloat* values = (bigfloat*)buffer;
+                    for (size_t i = 0; i < count; i++) values[i] = column->values.floats[order[i]];
+                    memcpy(column->values.floats, values, count * sizeof(bigfloat));
+                }
+            else if (column->dictionary)
+                {
+                    unsigned* values = (unsigned*)buffer;
+                    for (size_t i = 0; i < count; i++) values[i] = column->values.codes[order[i]];
+                    memcpy(column->values.codes, values, count * sizeof(unsigned));
+                }
+            else if (column->type == STRING_TYPE)
+                {
+                    size_t* values = (size_t*)buffer;
+                    for (size_t i = 0; i < count; i++) values[i] = column->values.offsets[order[i]];
+                    memcpy(column->values.offsets, values, count * sizeof(size_t));
+                }
+        }
+
+    free(buffer);
+    return 0;
+}
+
+// Writing functions
+static int _output_init(OUTPUT_BUFFER* output, P_PFILE file, size_t capacity)
+{
+    output->data = malloc(capacity);
+    output->length = 0;
+    output->capacity = capacity;
+    output->file = file;
+    output->failed = (output->data == NULL);
+    if (output->failed) PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR OUTPUT BUFFER");
+    return output->failed;
+}
+
+static int _output_reserve(OUTPUT_BUFFER* output, size_t size)
+{
+    if (output->failed) return 1;
+    if (output->capacity - output->length >= size) return 0;
 
-    // checking for 'bad' headers and making them str
-    _check_and_fix_header(parser);
+    if (output->file && _output_flush(output)) return 1;
+    if (output->capacity - output->length >= size) return 0;
 
-    // fixing all the remaining artefacts
-    _check_and_fix_parsed_data(parser);
+    size_t new_capacity = output->capacity;
+    while (new_capacity - output->length < size) INCREASE_CAP(&new_capacity);
 
-    // saving mem after all fixes
-    if (parser->settings.save_memory)
+    char* new_data = realloc(output->data, new_capacity);
+    if (!new_data)
         {
-            size_t cc = parser->container.column_count * sizeof(CONTAINER_DATA);
-            for (size_t i = 0; i < line_count; i++)
-                lines[i] = realloc(lines[i], cc);
+            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR OUTPUT BUFFER");
+            output->failed = 1;
+            return 1;
         }
 
+    output->data = new_data;
+    output->capacity = new_capacity;
     return 0;
 }
 
-static CONTAINER_DATA* _parse_line(const char* line, char splitter, size_t* token_count)
+static void _output_write(OUTPUT_BUFFER* output, const char* data, size_t length)
 {
-    char* line_copy = strdup(line);
-    if (!line_copy)
+    // data that doesn't fit into an empty buffer goes to the file directly
+    if (output->file && length >= output->capacity)
         {
-            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR LINE COPY");
-            return NULL;
+            if (_output_flush(output)) return;
+            if (fwrite(data, 1, length, output->file) != length) output->failed = 1;
+            return;
         }
 
-    size_t count = 0;
-    size_t capacity = INITIAL_TOKENS_CAPACITY;
+    if (_output_reserve(output, length)) return;
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+}
 
-    CONTAINER_DATA* tokens = malloc(capacity * sizeof(CONTAINER_DATA));
-    if (!tokens)
-        {
-            PARSER_LOG_CRITICAL("MEMORY ALLOCATION FAILED FOR TOKENS");
-            free(line_copy);
-            return NULL;
-        }
+static inline void _output_char(OUTPUT_BUFFER* output, char c)
+{
+    if (_output_reserve(output, 1)) return;
+    output->data[output->length++] = c;
+}
 
-    char* start = line_copy;
-    char* end = line_copy;
+static int _output_flush(OUTPUT_BUFFER* output)
+{
+    if (output->failed) return 1;
+    if (output->length && fwrite(output->data, 1, output->length, output->file) != output->length)
+        output->failed = 1;
+
+    output->length = 0;
+    return output->failed;
+}
+
+static void _output_free(OUTPUT_BUFFER* output)
+{
+    free(output->data);
+    output->data = NULL;
+    output->length = output->capacity = 0;
+}
 
-    while (*end)
+static void _save_rows(const PARSER_CONTAINER* container, size_t begin, size_t end, char splitter, OUTPUT_BUFFER* output)
+{
+    for (size_t i = begin; i < end && !output->failed; i++)
         {
-            if (*end == splitter)
+            size_t token_count = _row_length(container, i);
+
+            for (size_t j = 0; j < token_count; j++)
                 {
-                    *end = '\0';
-                    if (count >= capacity)
-                        {
-                            INCREASE_CAP(&capacity);
-                            tokens = realloc(tokens, capacity * sizeof(CONTAINER_DATA));
-                        }
-                    tokens[count++] = _parse_token(start);
-                    start = end + 1; // move to next token start
+                    CONTAINER_DATA data = _get_cell(container, i, j);
+                    handlers[data.type].save(&data, output);
+
+                    // last value without the splitter symbol
+                    _output_char(output, (j + 1 < token_count) ? splitter : '\n');
                 }
-            end++;
+
+            if (token_count == 0) _output_char(output, '\n');
+        }
+}
+
+static int _save_parallel(const PARSER_CONTAINER* container, char splitter, OUTPUT_BUFFER* output, size_t thread_count)
+{
+#ifdef FILEPARSER_NO_THREADS
+    (void)thread_count;
+    _save_rows(container, 0, container->line_count, splitter, output);
+    return output->failed;
+#else
+    SAVE_TASK* tasks = calloc(thread_count, sizeof(SAVE_TASK));
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+    int* started = calloc(thread_count, sizeof(int));
+    int result = (!tasks || !threads || !started);
+
+    for (size_t i = 0; i < thread_count && result == 0; i++)
+        result = _output_init(&tasks[i].output, NULL, OUTPUT_BUFFER_SIZE);
+
+    if (result)
+        {
+            PARSER_LOG_WARNING("MEMORY ALLOCATION FAILED FOR SAVING THREADS, SAVING IN ONE THREAD");
+            for (size_t i = 0; tasks && i < thread_count; i++) _output_free(&tasks[i].output);
+            free(tasks);
+            free(threads);
+            free(started);
+            _save_rows(container, 0, container->line_count, splitter, output);
+            return output->failed;
         }
 
-    // process if any last token
-    if (start < end)
+    // every thread formats one block of rows into its own buffer, blocks are written in order
+    size_t line_count = container->line_count;
+    for (size_t row = 0; row < line_count && result == 0;)
         {
-            if (count >= capacity)
+            size_t task_count = 0;
+            for (; task_count < thread_count && row < line_count; task_count++)
                 {
-                    capacity += 1;
-                    tokens = realloc(tokens, capacity * sizeof(CONTAINER_DATA));
+                    SAVE_TASK* task = &tasks[task_count];
+                    task->container = container;
+                    task->splitter = splitter;
+                    task->begin = row;
+                    task->end = (line_count - row > SAVE_BLOCK_ROWS) ? row + SAVE_BLOCK_ROWS : line_count;
+                    task->output.length = 0;
+                    row = task->end;
+                    started[task_count] = (pthread_create(&threads[task_count], NULL, _save_task_run, task) == 0);
                 }
-            tokens[count++] = _parse_token(start);
-        }
 
-    free(line_copy);
-    *token_count = count;
+            for (size_t i = 0; i < task_count; i++)
+                {
+                    if (started[i]) pthread_join(threads[i], NULL);
+                    else _save_task_run(&tasks[i]);
+                }
 
-    // checking if we can free some memory
-    //if (count < capacity)
-    //tokens = realloc(tokens, count * sizeof(CONTAINER_DATA));
+            for (size_t i = 0; i < task_count && result == 0; i++)
+                {
+                    if (tasks[i].output.failed) result = 1;
+                    else _output_write(output, tasks[i].output.data, tasks[i].output.length);
+                }
+        }
 
-    return tokens;
+    PARSER_LOG_INFO("FORMATTED %zu LINES IN %zu THREADS", line_count, thread_count);
+
+    for (size_t i = 0; i < thread_count; i++) _output_free(&tasks[i].output);
+    free(tasks);
+    free(threads);
+    free(started);
+    return result || output->failed;
+#endif
 }
 
-static CONTAINER_DATA _parse_token(char* token)
+#ifndef FILEPARSER_NO_THREADS
+static void* _save_task_run(void* arg)
 {
-    CONTAINER_DATA data;
+    SAVE_TASK* task = arg;
+    _save_rows(task->container, task->begin, task->end, task->splitter, &task->output);
+    return NULL;
+}
+#endif
 
-    // remove new lines, then trim whitespace
-    char* trimmed = _trim_whitespace(_trim_newlines(token));
-    char* unquoted = _remove_quotes(trimmed);
+static size_t _format_integer(ull value, char* buffer)
+{
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
 
-    int search_result = _check_for_quotes(trimmed, strlen(trimmed));
+    char digits[24];
+    size_t position = sizeof(digits);
 
-    // check for NULL/empty values
-    if (trimmed[0] == '\0' || search_result == 2 || strcasecmp(trimmed, "NULL") == 0)
+    while (value >= 100)
         {
-            data.type = NULL_TYPE;
-            data.value.null = NULL;
-            return data;
+            unsigned pair = (unsigned)(value % 100) * 2;
+            value /= 100;
+            digits[--position] = digit_pairs[pair + 1];
+            digits[--position] = digit_pairs[pair];
         }
 
-    // if search result is 1 then we always treat it as string no matter what
-    if (search_result)
+    if (value >= 10)
         {
-            data.type = STRING_TYPE;
-            data.value.string = strdup(unquoted);
-            return data;
+            digits[--position] = digit_pairs[value * 2 + 1];
+            digits[--position] = digit_pairs[value * 2];
         }
+    else digits[--position] = (char)('0' + value);
 
-    // try parsing as integer
-    char* endptr;
-    ull integer_value = strtoull(trimmed, &endptr, 10);
-    if (*endptr == '\0')
+    size_t length = sizeof(digits) - position;
+    memcpy(buffer, digits + position, length);
+    return length;
+}
+
+static size_t _format_float(bigfloat value, char* buffer, size_t size)
+{
+    size_t length = 0;
+    bigfloat magnitude = (value < 0) ? -value : value;
+
+    // shortest fixed notation that _parse_number reads back to the very same value,
+    // at least one decimal is kept so the value is a float again when parsed
+    if (magnitude == magnitude && magnitude < 1e18L)
+        for (size_t decimals = 1; decimals <= FAST_FLOAT_MAX_POW10 && decimals < FAST_NUMBER_MAX_DIGITS; decimals++)
+            {
+                bigfloat scaled = magnitude * powers_of_ten[decimals];
+                if (scaled >= 1e19L) break;
+
+                ull mantissa = (ull)(scaled + 0.5L);
+                if (mantissa > FAST_FLOAT_MAX_MANTISSA) break;
+                if ((bigfloat)mantissa / powers_of_ten[decimals] != magnitude) continue;
+
+                char digits[24];
+                size_t digit_count = _format_integer(mantissa, digits);
+
+                if (signbit(value)) buffer[length++] = '-';
+                if (digit_count <= decimals)
+                    {
+                        buffer[length++] = '0';
+                        buffer[length++] = '.';
+                        for (size_t i = digit_count; i < decimals; i++) buffer[length++] = '0';
+                        memcpy(buffer + length, digits, digit_count);
+                        length += digit_count;
+                    }
+                else
+                    {
+                        memcpy(buffer + length, digits, digit_count - decimals);
+                        length += digit_count - decimals;
+                        buffer[length++] = '.';
+                        memcpy(buffer + length, digits + digit_count - decimals, decimals);
+                        length += decimals;
+                    }
+                return length;
+            }
+
+    if (magnitude != magnitude || magnitude > LDBL_MAX)
+        return (size_t)snprintf(buffer, size, "%Lf", value); // nan and inf are written like before
+
+    // huge, tiny or long values: binary search for the shortest precision that survives strtold
+    int low = 1;
+    int high = LDBL_DIG + 3; // always enough to read the same value back
+    while (low < high)
         {
-            data.type = INTEGER_TYPE;
-            data.value.integer = integer_value;
-            return data;
+            int precision = low + (high - low) / 2;
+            snprintf(buffer, size, "%.*Lg", precision, value);
+            if (strtold(buffer, NULL) == value) high = precision;
+            else low = precision + 1;
         }
+    length = (size_t)snprintf(buffer, size, "%.*Lg", low, value);
 
-    // try parsing as float
-    endptr = NULL;
-    bigfloat float_value = strtold(trimmed, &endptr);
-    if (endptr != NULL && *endptr == '\0')
+    if (!strpbrk(buffer, ".e") && length + 2 < size)
         {
-            data.type = FLOAT_TYPE;
-            data.value.floating = float_value;
-            return data;
+            buffer[length++] = '.';
+            buffer[length++] = '0';
+            buffer[length] = '\0';
         }
-
-    // if neither worked, treat as string
-    data.type = STRING_TYPE;
-    data.value.string = strdup(unquoted);
-    return data;
+    return length;
 }
 
-static char* _trim_whitespace(char* str)
+// Printing
+inline static void _print_formatted_row(PARSER* parser, size_t row_idx, const size_t* col_widths)
 {
-    char* end;
-
-    // trim leading space
-    while (isspace((unsigned char)*str)) str++;
+    size_t column_count = parser->container.column_count;
+    for (size_t j = 0; j < column_count; j++)
+        {
+            CONTAINER_DATA cell = _get_cell(&parser->container, row_idx, j);
+            char* current_str = _container_value_to_str(&cell);
+            size_t current_width = _count_utf8_chars(current_str);
 
-    if (*str == 0)  // all spaces?
-        return str;
+            printf("%s", current_str);
 
-    // trim trailing space
-    end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
+            // add padding for alignment
+            size_t padding = col_widths[j] - current_width;
+            for (size_t k = 0; k < padding; k++)
+                putchar(' ');
 
-    // write new null terminator
-    *(end + 1) = '\0';
+            if (j < column_count - 1)
+                printf("  ");
 
-    return str;
+            free(current_str);
+        }
+    putchar('\n');
 }
 
-static char* _trim_newlines(char* str)
+// Logging functions
+static void _log_to_stderr(int level, const char* function, const char* file, int line, const char* format, va_list args)
 {
-    size_t len = strlen(str);
-
-    size_t search_index = strcspn(str, "\n\r");
-    while (search_index < len)
+    // the line is put together first, so lines of several threads don't get mixed
+    char message[TRACE_MESSAGE_SIZE];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    if (length >= 0 && (size_t)length < sizeof(message))
+        fprintf(stderr, "[%s]: %s:%s:%d: %s\n", loglevels[level], function, file, line, message);
+    else
         {
-            memmove(&str[search_index], &str[search_index + 1], len - search_index);
-            --len;
-            search_index = strcspn(str, "\n\r");
+            fprintf(stderr, "[%s]: %s:%s:%d: ", loglevels[level], function, file, line);
+            vfprintf(stderr, format, copy);
+            fputc('\n', stderr);
         }
+    va_end(copy);
+}
 
-    return str;
+static unsigned long long _trace_clock()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    unsigned long long ticks = (unsigned long long)counter.QuadPart, rate = (unsigned long long)frequency.QuadPart;
+    return ticks / rate * 1000000000ULL + ticks % rate * 1000000000ULL / rate;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+#endif
 }
 
-static int _check_for_quotes(char* str, size_t len)
+static TRACE_RING* _trace_create_ring(size_t capacity)
 {
-    if (len >= 2 && str[0] == '"' && str[len-1] == '"')
+    size_t rounded = TRACE_MIN_EVENTS;
+    while (rounded < capacity && rounded <= SIZE_MAX / 2 / sizeof(TRACE_EVENT))
+        rounded <<= 1;
+
+    TRACE_RING* ring = calloc(1, sizeof(TRACE_RING));
+    if (ring) ring->events = calloc(rounded, sizeof(TRACE_EVENT));
+    if (!ring || !ring->events)
         {
-            if (len > 2)
-                return 1;
-            else
-                return 2; // means that str is NULL
+            free(ring);
+            return NULL;
         }
-
-    return 0;
+    ring->capacity = rounded;
+    ring->owned = 1;
+    return ring;
 }
 
-static char* _remove_quotes(char* str)
+static TRACE_RING* _trace_ring()
 {
-    size_t len = strlen(str);
+#ifdef FILEPARSER_NO_THREADS
+    TRACE_RING* ring = trace_ring;
+#else
+    TRACE_RING* ring = pthread_getspecific(trace_key);
+#endif
+    if (ring) return ring;
+
+    // threads come and go with every parse, so the ring of a finished one is taken over before a new one is made
+    for (ring = ATOMIC_LOAD(&trace_rings); ring; ring = ring->next)
+        if (ATOMIC_CLAIM(&ring->owned)) break;
+    if (!ring)
+        {
+            ring = _trace_create_ring(ATOMIC_LOAD(&trace_capacity));
+            if (!ring) return NULL; // the message goes to stderr instead
+            TRACE_RING* next = ATOMIC_LOAD(&trace_rings);
+            do
+                ring->next = next;
+            while (!ATOMIC_CAS(&trace_rings, &next, ring));
+        }
+    ring->thread = ATOMIC_FETCH_ADD(&trace_threads, 1) + 1;
 
-    while (_check_for_quotes(str, len) == 1)
+#ifdef FILEPARSER_NO_THREADS
+    trace_ring = ring;
+#else
+    if (pthread_setspecific(trace_key, ring))
         {
-            // remove surrounding quotes somehow
-            memmove(str, str + 1, len - 2);
-            str[len - 2] = '\0';
-            len -= 2; // update length after modification
+            ATOMIC_STORE(&ring->owned, 0);
+            return NULL;
         }
-    return str;
+#endif
+    return ring;
 }
 
-static char* _create_new_header(size_t i)
+#ifndef FILEPARSER_NO_THREADS
+static void _trace_create_key()
 {
-    char* new_char = malloc(STRING_MAX_WIDTH);
-    snprintf(new_char, STRING_MAX_WIDTH, PARSER_COLUMN_CUSTOM_NAME, i);
-    return new_char;
+    trace_key_failed = pthread_key_create(&trace_key, _trace_release) != 0;
 }
 
-static void _check_and_fix_header(P_PARSER parser)
+static void _trace_release(void* ring)
 {
-    if (!parser->container.header_included || !parser->container.info[0].is_header)
-        {
-            PARSER_LOG_WARNING("[NO NEED TO FIX ANYTHING] OR [CAN\'T FIX THE HEADER LINE BECAUSE OF THE CONTAINER WRONG STATES]");
-            return;
-        }
-
-    PARSER_CONTAINER* data = &parser->container;
-    CONTAINER_DATA* header_line = data->lines[0];
-    LINE_INFO* header_info = &data->info[0];
+    // the events stay in the ring until they are dumped or overwritten by the next owner
+    ATOMIC_STORE(&((TRACE_RING*)ring)->owned, 0);
+}
+#endif
 
-    size_t header_column_count = header_info->token_count;
-    size_t column_count = data->column_count;
-    size_t i;
+static void _trace_record(TRACE_RING* ring, int level, const char* function, const char* file, int line, const char* format, va_list* args)
+{
+    // only this thread writes the ring, a dump reading the slot at the same time sees an odd or changed version and skips it
+    size_t head = ring->head;
+    TRACE_EVENT* event = &ring->events[head & (ring->capacity - 1)];
+    unsigned version = event->version;
+    ATOMIC_STORE(&event->version, version + 1);
+    ATOMIC_FENCE_RELEASE();
+
+    event->thread = ring->thread;
+    event->index = head;
+    event->time = _trace_clock() - trace_start;
+    event->format = format;
+    event->function = function;
+    event->file = file;
+    event->line = line;
+    event->level = (unsigned char)level;
+    _trace_capture(event, format, args);
+
+    ATOMIC_STORE(&event->version, version + 2);
+    ATOMIC_STORE(&ring->head, head + 1);
+}
 
-    // first we fix current headers
-    for (i = 0; i < header_column_count; i++)
+static const char* _trace_parse_spec(const char* c, TRACE_SPEC* spec)
+{
+    memset(spec, 0, sizeof(TRACE_SPEC));
+    spec->precision = -1;
+    spec->start = c++;
+    while (*c == '-' || *c == '+' || *c == ' ' || *c == '#' || *c == '0')
+        c++;
+    if (*c == '*')
         {
-            CONTAINER_DATA* current_data = &header_line[i];
-            switch(current_data->type)
+            spec->width_from_arg = 1;
+            c++;
+        }
+    while (isdigit((unsigned char)*c))
+        c++;
+    if (*c == '.')
+        {
+            c++;
+            if (*c == '*')
                 {
-                    case INTEGER_TYPE:
-                    case FLOAT_TYPE:
-                        _set_string(current_data, _container_value_to_str(current_data));
-                        PARSER_LOG_INFO("NEW FIXED HEADER IS %s", current_data->value.string);
-                        break;
-                    case NULL_TYPE:
-                        _set_string(current_data, _create_new_header(i));
-                        PARSER_LOG_INFO("NEW FIXED HEADER IS %s", current_data->value.string);
-                        break;
-                    case STRING_TYPE:
-                        break;
+                    spec->precision_from_arg = 1;
+                    c++;
+                }
+            else
+                {
+                    spec->precision = 0;
+                    while (isdigit((unsigned char)*c))
+                        spec->precision = spec->precision * 10 + (*c++ - '0');
                 }
         }
+    for (size_t i = 0; i < 2 && *c && strchr("hlLzjt", *c); i++)
+        spec->length[i] = *c++;
+    spec->conversion = *c;
+    spec->end = *c ? c + 1 : c;
+    return spec->end;
+}
 
-    // after we add a new header if there is a need in that
-    if (header_column_count < column_count)
+static size_t _trace_spec_args(const TRACE_SPEC* spec)
+{
+    if (spec->conversion == '%' || spec->conversion == '\0') return 0;
+    // wide strings and conversions printf doesn't know can't be copied, the message is cut before them
+    if (!strchr("diouxXcspneEfFgGaA", spec->conversion) || (spec->length[0] == 'l' && (spec->conversion == 's' || spec->conversion == 'c')))
+        return TRACE_MAX_ARGS + 1;
+    return (size_t)spec->width_from_arg + (size_t)spec->precision_from_arg + 1;
+}
+
+static long long _trace_integer_arg(const TRACE_SPEC* spec, va_list* args)
+{
+    int is_signed = spec->conversion == 'd' || spec->conversion == 'i';
+    switch (spec->length[0])
         {
-            PARSER_LOG_INFO("FIX IS NEEDED, PREPARING TO FILL THE HEADER LINE WITH %zu MORE VALUES", column_count - header_column_count);
-            header_line = realloc(header_line, column_count * sizeof(CONTAINER_DATA));
-            data->lines[0] = header_line;
-            header_info->token_count = column_count;
-            for (; i < column_count; i++)
-                {
-                    _set_string(&header_line[i], _create_new_header(i));
-                    PARSER_LOG_INFO("NEW HEADER IS %s", header_line[i].value.string);
-                }
+            case 'l':
+                if (spec->length[1] == 'l') return is_signed ? va_arg(*args, long long) : (long long)va_arg(*args, unsigned long long);
+                return is_signed ? va_arg(*args, long) : (long long)va_arg(*args, unsigned long);
+            case 'z':
+                return (long long)va_arg(*args, size_t);
+            case 'j':
+                return is_signed ? (long long)va_arg(*args, intmax_t) : (long long)va_arg(*args, uintmax_t);
+            case 't':
+                return (long long)va_arg(*args, ptrdiff_t);
+            default: // char and short arrive as int
+                return is_signed ? va_arg(*args, int) : (long long)va_arg(*args, unsigned);
         }
 }
 
-static void _check_and_fix_parsed_data(P_PARSER parser)
+static void _trace_capture(TRACE_EVENT* event, const char* format, va_list* args)
 {
-    PARSER_CONTAINER* container = &parser->container;
-    CONTAINER_DATA** lines = container->lines;
-    LINE_INFO* info = container->info;
-    size_t column_count = container->column_count;
-    size_t line_count = container->line_count;
+    TRACE_SPEC spec;
+    event->arg_count = 0;
+    event->text_length = 0;
+    event->text[TRACE_TEXT_SIZE - 1] = '\0'; // strings that don't fit point here
 
-    // iterating over all the values to find some 'broken' values
-    for (size_t i = 0; i < line_count; i++)
+    for (const char* c = strchr(format, '%'); c; c = strchr(c, '%'))
         {
-            CONTAINER_DATA* current_line = lines[i];
-            size_t line_column_count = info[i].token_count;
+            c = _trace_parse_spec(c, &spec);
+            size_t needed = _trace_spec_args(&spec);
+            if (!needed) continue;
+            if (event->arg_count + needed > TRACE_MAX_ARGS) return; // the rest of the message is cut off
+
+            int precision = spec.precision;
+            if (spec.width_from_arg) event->args[event->arg_count++].integer = va_arg(*args, int);
+            if (spec.precision_from_arg)
+                {
+                    precision = va_arg(*args, int);
+                    event->args[event->arg_count++].integer = precision;
+                }
 
-            if (line_column_count < column_count)
+            TRACE_ARG* arg = &event->args[event->arg_count++];
+            switch (spec.conversion)
                 {
-                    PARSER_LOG_INFO("ADDING %zu NULL VALUES TO THE %zu LINE", column_count - line_column_count, i);
-                    current_line = realloc(current_line, column_count * sizeof(CONTAINER_DATA));
-                    lines[i] = current_line;
-                    info[i].token_count = column_count;
-                    for (size_t j = line_column_count; j < column_count; j++)
+                    case 's':
                         {
-                            _set_null(&current_line[j]);
+                            // the string may be gone by the time the trace is dumped, so it is copied (as much as fits)
+                            const char* string = va_arg(*args, const char*);
+                            if (!string) string = "(null)";
+                            const char* terminator = precision >= 0 ? memchr(string, '\0', (size_t)precision) : NULL;
+                            size_t length = precision >= 0 ? (terminator ? (size_t)(terminator - string) : (size_t)precision) : strlen(string);
+                            size_t room = TRACE_TEXT_SIZE - 1 - event->text_length;
+                            if (!room)
+                                {
+                                    arg->text = TRACE_TEXT_SIZE - 1;
+                                    break;
+                                }
+                            if (length >= room) length = room - 1;
+                            arg->text = event->text_length;
+                            memcpy(event->text + event->text_length, string, length);
+                            event->text[event->text_length + length] = '\0';
+                            event->text_length += (unsigned short)(length + 1);
+                            break;
                         }
+                    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                        if (spec.length[0] == 'L')
+                            arg->long_floating = va_arg(*args, long double);
+                        else
+                            arg->floating = va_arg(*args, double);
+                        break;
+                    case 'p': case 'n':
+                        arg->pointer = va_arg(*args, void*);
+                        break;
+                    default:
+                        arg->integer = _trace_integer_arg(&spec, args);
+                        break;
                 }
         }
 }
 
-// Sorting functions
-static int _compare_cells(
-    const size_t a_idx,
-    const size_t b_idx,
-    const size_t sort_column,
-    PARSER* parser)
+static int _trace_print_integer(char* buffer, size_t size, const char* piece, const TRACE_SPEC* spec, long long value)
 {
-    PARSER_CONTAINER* container = &parser->container;
-    PARSER_SORT_SETTINGS* settings = &parser->sort_settings;
+    int is_signed = spec->conversion == 'd' || spec->conversion == 'i';
+    switch (spec->length[0])
+        {
+            case 'l':
+                if (spec->length[1] == 'l') return is_signed ? snprintf(buffer, size, piece, value) : snprintf(buffer, size, piece, (unsigned long long)value);
+                return is_signed ? snprintf(buffer, size, piece, (long)value) : snprintf(buffer, size, piece, (unsigned long)value);
+            case 'z':
+                return snprintf(buffer, size, piece, (size_t)value);
+            case 'j':
+                return is_signed ? snprintf(buffer, size, piece, (intmax_t)value) : snprintf(buffer, size, piece, (uintmax_t)value);
+            case 't':
+                return snprintf(buffer, size, piece, (ptrdiff_t)value);
+            default:
+                return is_signed ? snprintf(buffer, size, piece, (int)value) : snprintf(buffer, size, piece, (unsigned)value);
+        }
+}
 
-    CONTAINER_DATA* data_a = container->lines[a_idx];
-    CONTAINER_DATA* data_b = container->lines[b_idx];
+static void _trace_append(char* message, size_t size, size_t* used, const char* text, size_t length)
+{
+    if (length > size - 1 - *used) length = size - 1 - *used;
+    memcpy(message + *used, text, length);
+    *used += length;
+    message[*used] = '\0';
+}
 
-    CONTAINER_DATA cell_a = data_a[sort_column];
-    CONTAINER_DATA cell_b = data_b[sort_column];
+static void _trace_format(const TRACE_EVENT* event, char* message, size_t size)
+{
+    TRACE_SPEC spec;
+    size_t used = 0, arg = 0;
+    const char* c = event->format;
+    message[0] = '\0';
 
-    int result = 0;
-    if (cell_a.type == cell_b.type)
+    while (*c)
         {
-            switch (cell_a.type)
+            const char* percent = strchr(c, '%');
+            _trace_append(message, size, &used, c, percent ? (size_t)(percent - c) : strlen(c));
+            if (!percent) break;
+
+            c = _trace_parse_spec(percent, &spec);
+            size_t needed = _trace_spec_args(&spec);
+            if (!needed)
                 {
-                    case INTEGER_TYPE:
-                        if (cell_a.value.integer < cell_b.value.integer) result = -1;
-                        else if (cell_a.value.integer > cell_b.value.integer) result = 1;
-                        else result = 0;
-                        break;
-                    case FLOAT_TYPE:
-                        if (cell_a.value.floating < cell_b.value.floating) result = -1;
-                        else if (cell_a.value.floating > cell_b.value.floating) result = 1;
-                        else result =  0;
+                    if (spec.conversion == '%') _trace_append(message, size, &used, "%", 1);
+                    continue;
+                }
+            if (arg + needed > event->arg_count)
+                {
+                    _trace_append(message, size, &used, "...", 3);
+                    break;
+                }
+
+            // every spec is printed on its own, numbers that came from arguments are written into it
+            char piece[TRACE_SPEC_SIZE];
+            size_t length = 0;
+            const char* p = spec.start;
+            for (; p < spec.end && length + NUMBER_BUFFER_CAPACITY / 2 < sizeof(piece); p++)
+                {
+                    if (*p == '*')
+                        length += (size_t)snprintf(piece + length, sizeof(piece) - length, "%lld", event->args[arg++].integer);
+                    else
+                        piece[length++] = *p;
+                }
+            piece[length] = '\0';
+            if (p < spec.end)
+                {
+                    _trace_append(message, size, &used, "...", 3);
+                    break;
+                }
+
+            const TRACE_ARG* value = &event->args[arg++];
+            size_t room = size - used;
+            int written = 0;
+            switch (spec.conversion)
+                {
+                    case 's':
+                        written = snprintf(message + used, room, piece, event->text + value->text);
                         break;
-                    case STRING_TYPE:
-                        if (settings->case_sensitive)
-                            result = strcmp(cell_a.value.string, cell_b.value.string);
+                    case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                        if (spec.length[0] == 'L')
+                            written = snprintf(message + used, room, piece, value->long_floating);
                         else
-                            result = strcasecmp(cell_a.value.string, cell_b.value.string);
+                            written = snprintf(message + used, room, piece, value->floating);
                         break;
-                    case NULL_TYPE:
-                        result =  0; // equality muthafaka
+                    case 'p':
+                        written = snprintf(message + used, room, piece, value->pointer);
+                        break;
+                    case 'n':
                         break;
                     default:
-                        exit(1); // just in case
+                        written = _trace_print_integer(message + used, room, piece, &spec, value->integer);
+                        break;
                 }
+            if (written > 0) used += (size_t)written < room ? (size_t)written : room - 1;
         }
-    else if (cell_a.type == NULL_TYPE || cell_b.type == NULL_TYPE)
-        {
-            if (cell_a.type == NULL_TYPE) result = 1;
-            else result = -1;
-        }
-    else
-        {
-            char* str_a = _container_value_to_str(&cell_a);
-            char* str_b = _container_value_to_str(&cell_b);
-
-            if (settings->case_sensitive)
-                result = strcmp(str_a, str_b);
-            else
-                result = strcasecmp(str_a, str_b);
+}
 
-            free(str_a);
-            free(str_b);
-        }
+static int _trace_compare_events(const void* a, const void* b)
+{
+    const TRACE_EVENT* first = a;
+    const TRACE_EVENT* second = b;
+    if (first->time != second->time) return first->time < second->time ? -1 : 1;
+    if (first->thread != second->thread) return first->thread < second->thread ? -1 : 1;
+    return first->index < second->index ? -1 : first->index > second->index;
+}
 
-    if (settings->direction == DESCENDING)
-        result = -result;
+// Statistics functions
+#ifdef FILEPARSER_STATS
+static double _stats_wall()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
 
-    PARSER_LOG_DEBUG("[COMPARE FUNCTION] - COMPARING RESULT: %d", result);
-    return result;
+static void _stats_now(PARSER_TIMER* now)
+{
+    now->wall = _stats_wall();
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    ULARGE_INTEGER kernel_time, user_time;
+    kernel_time.LowPart = kernel.dwLowDateTime;
+    kernel_time.HighPart = kernel.dwHighDateTime;
+    user_time.LowPart = user.dwLowDateTime;
+    user_time.HighPart = user.dwHighDateTime;
+    now->cpu = (double)(kernel_time.QuadPart + user_time.QuadPart) * 1e-7; // 100 ns units
+#else
+    struct timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    now->cpu = (double)cpu.tv_sec + (double)cpu.tv_nsec * 1e-9;
+#endif
 }
 
-static void _quick_sort(PARSER* parser, size_t sort_column, QuickSortComp comp_func, size_t left, size_t right, size_t* indices)
+static void _stats_stop(PARSER_TIMER* total, const PARSER_TIMER* start)
 {
-    if (left < right)
-        {
-            size_t pr = _partition(parser, sort_column, comp_func, left, right, indices);
-            if (pr > left) // avoid infinite recursion if pr is 0
-                _quick_sort(parser, sort_column, comp_func, left, pr - 1, indices);
-            _quick_sort(parser, sort_column, comp_func, pr + 1, right, indices);
-        }
+    PARSER_TIMER now;
+    _stats_now(&now);
+    total->wall += now.wall - start->wall;
+    total->cpu += now.cpu - start->cpu;
 }
 
-static size_t _partition(PARSER* parser, size_t sort_column, QuickSortComp comp_func, size_t left, size_t right, size_t* indices)
+static int _stats_line_start(PARSE_STATE* state, double* line_start)
 {
-    PARSER_LOG_DEBUG("[QUICK SORT] - LEFT: %zu, RIGHT: %zu", left, right);
-    size_t i = left, j, pivot_idx = right;
-    for (j = left; j < right; j++)
+    // reading a clock for every line would cost more than some lines take to parse, so only a sample is timed:
+    // the time since the line before a timed one is spent finding it (and reading it), the time in here converting it
+    int timed = (state->stats_lines++ % STATS_SAMPLE_LINES) == 0;
+    *line_start = 0;
+    if (timed)
         {
-            if (comp_func(indices[j], indices[pivot_idx], sort_column, parser) < 0)
-                _swap(&indices[i++], &indices[j]);
+            *line_start = _stats_wall();
+            state->stats.tokenizing.wall += *line_start - state->stats_mark;
         }
-    _swap(&indices[i], &indices[pivot_idx]);
-    PARSER_LOG_DEBUG("[QUICK SORT] - PARTITION KEY: %zu", i);
-    return i;
+    return timed;
 }
 
-static inline void _swap(size_t* a, size_t* b)
+static void _stats_line_done(PARSE_STATE* state, int timed, double line_start)
 {
-    size_t temp = *a;
-    *a = *b;
-    *b = temp;
+    int marks = (state->stats_lines % STATS_SAMPLE_LINES) == 0; // the next line is timed
+    if (!timed && !marks) return;
+
+    double now = _stats_wall();
+    if (timed) state->stats.converting.wall += now - line_start;
+    if (marks) state->stats_mark = now;
 }
 
-// Printing
-inline static void _print_formatted_row(PARSER* parser, size_t row_idx, const size_t* col_widths)
+static inline void _stats_add_timer(PARSER_TIMER* timer, const PARSER_TIMER* other)
 {
-    size_t column_count = parser->container.column_count;
-    for (size_t j = 0; j < column_count; j++)
-        {
-            char* current_str = _container_value_to_str(&parser->container.lines[row_idx][j]);
-            size_t current_width = _count_utf8_chars(current_str);
-
-            printf("%s", current_str);
-
-            // add padding for alignment
-            size_t padding = col_widths[j] - current_width;
-            for (size_t k = 0; k < padding; k++)
-                putchar(' ');
+    timer->wall += other->wall;
+    timer->cpu += other->cpu;
+}
 
-            if (j < column_count - 1)
-                printf("  ");
+static void _stats_merge(PARSER_STATS* stats, const PARSER_STATS* other)
+{
+    _stats_add_timer(&stats->reading, &other->reading);
+    _stats_add_timer(&stats->tokenizing, &other->tokenizing);
+    _stats_add_timer(&stats->converting, &other->converting);
+    _stats_add_timer(&stats->fixing, &other->fixing);
+    _stats_add_timer(&stats->sorting, &other->sorting);
+    _stats_add_timer(&stats->saving, &other->saving);
+
+    stats->bytes_read += other->bytes_read;
+    stats->bytes_written += other->bytes_written;
+    stats->rows_parsed += other->rows_parsed;
+    stats->rows_filtered += other->rows_filtered;
+    for (size_t i = 0; i <= RAW_TYPE; i++) stats->cells[i] += other->cells[i];
+    stats->reallocs += other->reallocs;
+    stats->comparisons += other->comparisons;
+}
 
-            free(current_str);
+static void _stats_add_parse(PARSER* parser, const PARSE_STATE* state, const PARSER_TIMER* start)
+{
+    // the parse is timed as a whole and split between the phases in the proportions of the timed lines
+    PARSER_TIMER total = { 0, 0 };
+    _stats_stop(&total, start);
+
+    PARSER_STATS stats = state->stats;
+    double reading = stats.reading.wall;
+    double tokenizing = (stats.tokenizing.wall > reading) ? stats.tokenizing.wall - reading : 0;
+    double converting = stats.converting.wall;
+    double sampled = reading + tokenizing + converting;
+    if (sampled <= 0)
+        {
+            converting = 1;
+            sampled = 1;
         }
-    putchar('\n');
+
+    stats.reading.wall = total.wall * reading / sampled;
+    stats.reading.cpu = total.cpu * reading / sampled;
+    stats.tokenizing.wall = total.wall * tokenizing / sampled;
+    stats.tokenizing.cpu = total.cpu * tokenizing / sampled;
+    stats.converting.wall = total.wall * converting / sampled;
+    stats.converting.cpu = total.cpu * converting / sampled;
+    _stats_merge(&parser->stats, &stats);
 }
+#endif
 
 // Utilities (global)
 static size_t _count_utf8_chars(const char* s)
@@ -979,25 +7064,31 @@ static size_t _count_utf8_chars(const char* s)
 static char* _container_value_to_str(CONTAINER_DATA* data)
 {
     char* str_buffer = malloc(STRING_MAX_WIDTH);
+    if (str_buffer) _format_value(data, str_buffer, STRING_MAX_WIDTH);
+    return str_buffer;
+}
 
+static void _format_value(const CONTAINER_DATA* data, char* buffer, size_t size)
+{
     switch (data->type)
         {
             case STRING_TYPE:
-                strncpy(str_buffer, data->value.string, STRING_MAX_WIDTH);
-                str_buffer[STRING_MAX_WIDTH - 1] = '\0'; // Ensure null termination
+                strncpy(buffer, data->value.string, size);
+                buffer[size - 1] = '\0'; // Ensure null termination
                 break;
             case INTEGER_TYPE:
-                snprintf(str_buffer, STRING_MAX_WIDTH, "%llu", data->value.integer);
+                snprintf(buffer, size, "%llu", data->value.integer);
                 break;
             case FLOAT_TYPE:
-                snprintf(str_buffer, STRING_MAX_WIDTH, "%Lf", data->value.floating);
+                snprintf(buffer, size, "%Lf", data->value.floating);
                 break;
             case NULL_TYPE:
-                strncpy(str_buffer, "NULL", STRING_MAX_WIDTH);
+                strncpy(buffer, "NULL", size);
+                break;
+            case RAW_TYPE:
+                snprintf(buffer, size, "%.*s", (int)data->value.raw.length, data->value.raw.data);
                 break;
         }
-
-    return str_buffer;
 }
 
 static inline void _set_string(CONTAINER_DATA* data, char* str)
@@ -34,7 +34,15 @@
 #define LOGLEVEL_NONE     4
 
 #ifndef LOG_LEVEL
-#define LOG_LEVEL LOGLEVEL_INFO // CHANGE THIS TO LOGLEVEL_NONE IF YOU WANT FOR THIS LIB TO SHUT UP
+#define LOG_LEVEL LOGLEVEL_INFO // level at startup, see set_log_level. CHANGE THIS TO LOGLEVEL_NONE IF YOU WANT FOR THIS LIB TO SHUT UP (the calls are compiled out then)
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __parser_unlikely(condition) __builtin_expect(!!(condition), 0)
+#define __parser_printf_format(format_index, first_arg) __attribute__((format(printf, format_index, first_arg)))
+#else
+#define __parser_unlikely(condition) (condition)
+#define __parser_printf_format(format_index, first_arg)
 #endif
 
 static const char* loglevels[] =
@@ -46,13 +54,25 @@ static const char* loglevels[] =
     [LOGLEVEL_NONE] = "NONE"
 };
 
+extern int parser_log_level; // highest level that is written, -1 for none (set_log_level changes it)
+
+// set_log_level can run while other threads log, a relaxed atomic load costs the same as a plain one
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(FILEPARSER_NO_THREADS)
+#define __parser_log_level() __atomic_load_n(&parser_log_level, __ATOMIC_RELAXED)
+#else
+#define __parser_log_level() (parser_log_level)
+#endif
+
+// the format has to be a string literal, traced messages are only formatted when they are dumped
+void __parser_log_write(int level, const char* function, const char* file, int line, const char* format, ...) __parser_printf_format(5, 6);
+
 #if LOG_LEVEL > LOGLEVEL_DEBUG
 #define __parser_log(level, format, ...) ((void)0)
 #else
 #define __parser_log(level, format, ...) \
     do { \
-            if (level <= LOG_LEVEL)\
-                fprintf(stderr, "[%s]: %s:%s:%zu: " format "\n", loglevels[level], __func__, __FILE__, __LINE__, ##__VA_ARGS__); \
+            if (__parser_unlikely(level <= __parser_log_level()))\
+                __parser_log_write(level, __func__, __FILE__, __LINE__, format, ##__VA_ARGS__); \
         } while (0)
 #endif
 
@@ -65,21 +85,19 @@ static const char* loglevels[] =
 typedef unsigned long long ull;
 typedef long double bigfloat;
 
-typedef struct __parser_settings
+typedef enum __container_layout
 {
-    char splitter;
-    int ignore_first_line;
-    int ignore_errors;
-    int first_line_as_header;
-    int save_memory; // makes parsing slower but saving a lot of memory
-} PARSER_SETTINGS;
+    ROW_LAYOUT,
+    COLUMNAR_LAYOUT
+} CONTAINER_LAYOUT;
 
 typedef enum __container_data_type
 {
     STRING_TYPE,
     INTEGER_TYPE,
     FLOAT_TYPE,
-    NULL_TYPE
+    NULL_TYPE,
+    RAW_TYPE // not converted yet, see lazy_types
 } DATA_TYPE;
 
 typedef union __container_data_var
@@ -88,6 +106,16 @@ typedef union __container_data_var
     ull integer;
     bigfloat floating;
     void* null;
+    struct
+    {
+        const char* data;
+        size_t length;
+    } raw; // text of a RAW_TYPE field, exactly as it was in the input
+    struct
+    {
+        char* string; // the same pointer as .string
+        unsigned int code;
+    } coded; // STRING_TYPE cells of dictionary encoded columns also carry their code
 } DATA_VAR;
 
 typedef struct __container_data
@@ -96,19 +124,105 @@ typedef struct __container_data
     DATA_VAR value;
 } CONTAINER_DATA;
 
+typedef enum __filter_operator
+{
+    FILTER_EQUAL,
+    FILTER_NOT_EQUAL,
+    FILTER_LESS,
+    FILTER_LESS_EQUAL,
+    FILTER_GREATER,
+    FILTER_GREATER_EQUAL,
+    FILTER_IS_NULL,
+    FILTER_NOT_NULL
+} FILTER_OPERATOR;
+
+typedef struct __parser_filter
+{
+    size_t column; // column of the container (after the projection)
+    FILTER_OPERATOR operation;
+    CONTAINER_DATA value; // not used by FILTER_IS_NULL and FILTER_NOT_NULL
+} PARSER_FILTER;
+
+// with thread_count other than 1 it's called from every parse thread at once, in no particular line order,
+// so it and user_data have to be thread safe
+typedef int (*RowFilter)(const CONTAINER_DATA* row, size_t column_count, void* user_data);
+
+typedef struct __parser_settings
+{
+    char splitter;
+    int ignore_first_line;
+    int ignore_errors;
+    int first_line_as_header;
+    int save_memory; // makes parsing slower but saving a lot of memory
+    int use_mmap; // maps the whole file into memory and parses it in place (falls back to stdio if mapping fails)
+    size_t thread_count; // number of threads for parsing and sorting, 0 means all available cores
+    CONTAINER_LAYOUT layout; // how the container keeps parsed data (rows of cells or typed columns)
+    int lazy_types; // keeps fields as raw text and converts them the first time they are used (ROW_LAYOUT only)
+    size_t schema_sample_rows; // rows used to infer the type of every column, 0 turns the inference off
+    int dictionary_encoding; // stores every distinct string of a column once and gives cells a code into it
+    const size_t* projection; // input columns to keep, in this order (NULL keeps every column)
+    const char* const* projection_names; // or their names in the first line, used when projection is NULL
+    size_t projection_count;
+    const PARSER_FILTER* filters; // data lines have to pass every filter to be kept
+    size_t filter_count;
+    RowFilter row_filter; // called with every typed data line that passed the filters, returning 0 drops it
+    void* row_filter_data; // handed to row_filter, shared by all parse threads
+    int quoted_fields; // splitters and line breaks between quotes are part of the field, "" in it is one quote (RFC 4180)
+} PARSER_SETTINGS;
+
 typedef struct _line_info
 {
     size_t token_count;
     int is_header;
 } LINE_INFO;
 
+typedef struct __parser_dictionary
+{
+    char** values; // distinct strings of a column in strcmp order, the code of a string is its index here
+    unsigned int* folded; // rank of every code in strcasecmp order, strings equal up to case share a rank
+    size_t count; // 0 when the column isn't dictionary encoded
+} PARSER_DICTIONARY;
+
+typedef struct __parser_column
+{
+    DATA_TYPE type; // type of every non NULL cell (NULL_TYPE if there are none)
+    unsigned char* types; // type of every cell, only set when the column mixes types
+    unsigned char* nulls; // bitmap, a set bit means the cell is NULL
+    union
+    {
+        ull* integers;
+        bigfloat* floats;
+        size_t* offsets; // offsets of the strings in the container string heap
+        unsigned int* codes; // dictionary codes of the strings, used instead of offsets when the column has a dictionary
+        DATA_VAR* mixed; // for mixed columns, strings keep their heap offset (or their code) in .integer
+    } values;
+    const PARSER_DICTIONARY* dictionary; // set when the strings of the column are dictionary encoded
+} PARSER_COLUMN;
+
+#define PARSER_COLUMN_IS_NULL(column, i) ((((column)->nulls[(i) >> 3]) >> ((i) & 7)) & 1)
+
+typedef struct __parser_schema_column
+{
+    DATA_TYPE type; // type of every non NULL cell of the sample (NULL_TYPE if they differ or there are none)
+    int nullable; // the sample has NULL cells in this column
+} PARSER_SCHEMA_COLUMN;
+
 typedef struct __parser_container
 {
-    CONTAINER_DATA** lines;
-    LINE_INFO* info;
+    CONTAINER_DATA** lines; // ROW_LAYOUT only
+    LINE_INFO* info; // ROW_LAYOUT only
     size_t line_count;
     size_t column_count;
     int header_included;
+
+    CONTAINER_LAYOUT layout;
+    PARSER_COLUMN* columns; // COLUMNAR_LAYOUT only, data lines without the header
+    CONTAINER_DATA* header; // COLUMNAR_LAYOUT only, the header line if it's included
+    char* string_heap; // COLUMNAR_LAYOUT only, every string of the columns ends with '\0'
+    size_t string_heap_size;
+
+    PARSER_SCHEMA_COLUMN* schema; // column_count entries inferred from the first data rows (NULL if inference is off)
+    PARSER_DICTIONARY* dictionaries; // column_count entries with dictionary_encoding, NULL otherwise
 } PARSER_CONTAINER;
 
 
@@ -139,21 +253,97 @@ typedef struct __parser_sort_settings
     int case_sensitive;
 } PARSER_SORT_SETTINGS;
 
+typedef struct __parser_row_range
+{
+    size_t first; // first row of the range (as used by get_cell)
+    size_t count;
+} PARSER_ROW_RANGE;
+
+typedef enum __aggregate_function
+{
+    AGGREGATE_COUNT, // non NULL cells
+    AGGREGATE_SUM,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_MEAN
+} AGGREGATE_FUNCTION;
+
+typedef struct __parser_aggregation
+{
+    size_t column;
+    AGGREGATE_FUNCTION function;
+} PARSER_AGGREGATION;
+
+typedef struct __parser_arena_block PARSER_ARENA_BLOCK;
+
+typedef struct __parser_arena
+{
+    PARSER_ARENA_BLOCK* blocks; // the first one is the block we currently allocate from
+    size_t block_count;
+    size_t total_size;
+} PARSER_ARENA;
+
+typedef struct __parser_index PARSER_INDEX;
+
+typedef struct __parser_timer
+{
+    double wall; // seconds
+    double cpu; // seconds of CPU time of the whole process, so the time of every thread adds up
+} PARSER_TIMER;
+
+typedef struct __parser_stats
+{
+    PARSER_TIMER reading; // reading the file (or mapping it)
+    PARSER_TIMER tokenizing; // finding lines and fields
+    PARSER_TIMER converting; // turning fields into cells, filters included
+    PARSER_TIMER fixing; // naming header columns and padding short lines after parsing
+    PARSER_TIMER sorting;
+    PARSER_TIMER saving;
+    size_t bytes_read;
+    size_t bytes_written;
+    size_t rows_parsed; // data lines kept
+    size_t rows_filtered; // data lines dropped by the filters
+    size_t cells[RAW_TYPE + 1]; // cells of the parsed data lines by DATA_TYPE, padding NULLs included
+    size_t reallocs; // times the line arrays, the line buffer or the filter and dictionary scratch had to grow
+    size_t comparisons; // made by sort_data (radix sorts make none)
+} PARSER_STATS;
+
 typedef struct __parser_object
 {
     PARSER_CONTAINER container;
     PARSER_SORT_SETTINGS sort_settings;
+    int sorted; // rows are in sort_settings order, set by a successful sort_data
+    size_t sorted_column;
     PARSER_SETTINGS settings;
+    PARSER_ARENA arena; // owns every row and string of the container
+    const char* source; // mapped input file, kept while lazy cells point into it
+    size_t source_size;
+    size_t follow_offset; // bytes of the file parsed by refresh_file, 0 when the parser doesn't follow one
+    PARSER_INDEX* indexes; // hash indexes made by build_index, sort_data keeps them up to date
+    PARSER_STATS stats; // adds up over every call, only filled when the library is built with FILEPARSER_STATS
 } PARSER;
 
 typedef PARSER* P_PARSER;
 
 P_PARSER create_parser();
 int parse_file(PARSER* parser, const char* filename);
+int refresh_file(PARSER* parser, const char* filename);
 int sort_data(PARSER* parser, PARSER_SORT_SETTINGS settings);
+int sort_data_by_keys(PARSER* parser, const PARSER_SORT_SETTINGS* keys, size_t key_count);
 int save_data(PARSER* parser, const char* filename);
+int save_snapshot(PARSER* parser, const char* filename);
+int load_snapshot(PARSER* parser, const char* filename);
 int print_all_data(PARSER* parser);
 int print_data(PARSER* parser, size_t how_much_to_print);
+CONTAINER_DATA get_cell(PARSER* parser, size_t row, size_t column);
+const PARSER_COLUMN* get_column(PARSER* parser, size_t column);
+int build_index(PARSER* parser, size_t column);
+const size_t* lookup_index(PARSER* parser, size_t column, CONTAINER_DATA value, size_t* count);
+int find_lower_bound(PARSER* parser, CONTAINER_DATA value, size_t* row);
+int find_upper_bound(PARSER* parser, CONTAINER_DATA value, size_t* row);
+int find_range(PARSER* parser, CONTAINER_DATA from, CONTAINER_DATA to, PARSER_ROW_RANGE* range);
+P_PARSER aggregate(PARSER* parser, const size_t* group_columns, size_t group_count, const PARSER_AGGREGATION* aggregations, size_t aggregation_count);
+void reset_stats(PARSER* parser);
 void free_parser(PARSER* parser);
 
 PARSER_SETTINGS create_parser_settings();
@@ -162,4 +352,9 @@ void change_default_settings(PARSER_SETTINGS settings);
 PARSER_SORT_SETTINGS create_parser_sort_settings();
 void change_default_sort_settings(PARSER_SORT_SETTINGS settings);
 
+void set_log_level(int level);
+int get_log_level();
+int enable_log_trace(size_t events_per_thread);
+int dump_log_trace(FILE* file);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,532 @@
+/**
+ * Made by Arseniy Kuskov
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * No warranty is given.
+ */
+
+/**
+ * Benchmark for parse_file, sort_data and save_data.
+ * Generates a deterministic CSV file (the same options and seed always give the same bytes),
+ * times every phase and prints one JSON object per line to stdout.
+ *
+ * gcc -O2 -DLOG_LEVEL=LOGLEVEL_NONE fileparser_bench.c fileparser.c -o fileparser_bench -pthread
+ * ./fileparser_bench --rows=1000000 --columns=8 --mix=2,1,1 --nulls=0.05 --quotes=0.1
+ */
+
+// clock_gettime and getrusage are POSIX
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "fileparser.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+/* =============== MACROS ================ */
+#define BENCH_TYPE_COUNT 3
+
+/* =============== TYPES ================ */
+typedef struct __bench_options
+{
+    size_t rows;
+    size_t columns;
+    unsigned int mix[BENCH_TYPE_COUNT]; // weights of integer, float and string columns
+    double null_ratio; // share of fields written as NULL ("" or NULL)
+    double quote_ratio; // share of non NULL fields wrapped in quotes
+    size_t string_width; // strings get 1 to string_width letters
+    size_t number_width; // integers get up to number_width digits, floats as many before the point
+    unsigned long long seed;
+    size_t repeat; // runs of every phase, the best one is reported
+    const char* input; // generated file
+    const char* output; // file written by the save phase
+    int keep_files;
+    PARSER_SETTINGS settings;
+} BENCH_OPTIONS;
+
+typedef struct __bench_result
+{
+    double best;
+    double total;
+    size_t runs;
+} BENCH_RESULT;
+
+static const DATA_TYPE bench_types[BENCH_TYPE_COUNT] = { INTEGER_TYPE, FLOAT_TYPE, STRING_TYPE };
+static const char* bench_type_names[BENCH_TYPE_COUNT] = { "int", "float", "string" };
+
+/* =============== PRIVATE DECLARATIONS ================ */
+static int _parse_options(int argc, char** argv, BENCH_OPTIONS* options);
+static int _parse_mix(const char* text, unsigned int* mix);
+static void _print_usage(const char* name);
+static void _assign_column_types(const BENCH_OPTIONS* options, size_t* types);
+static int _generate_file(const BENCH_OPTIONS* options, const size_t* types, size_t* size);
+static unsigned long long _next_random(unsigned long long* state);
+static double _next_unit(unsigned long long* state);
+static size_t _write_field(char* buffer, size_t type, const BENCH_OPTIONS* options, unsigned long long* state);
+static P_PARSER _parse_input(const BENCH_OPTIONS* options, double* seconds);
+static int _bench_parse(const BENCH_OPTIONS* options, BENCH_RESULT* result);
+static int _bench_sort(const BENCH_OPTIONS* options, size_t column, SORT_DIRECTION direction, BENCH_RESULT* result);
+static int _bench_save(const BENCH_OPTIONS* options, BENCH_RESULT* result, size_t* size);
+static void _add_run(BENCH_RESULT* result, double seconds);
+static void _report(const char* phase, const BENCH_RESULT* result, size_t bytes, size_t rows);
+static double _now();
+static size_t _peak_rss_kb();
+static size_t _file_size(const char* filename);
+
+/* =============== MAIN ================ */
+int main(int argc, char** argv)
+{
+    BENCH_OPTIONS options;
+    if (_parse_options(argc, argv, &options))
+        {
+            _print_usage(argv[0]);
+            return 1;
+        }
+
+    size_t* column_types = malloc(options.columns * sizeof(size_t));
+    if (column_types == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+    _assign_column_types(&options, column_types);
+
+    size_t input_size = 0;
+    if (_generate_file(&options, column_types, &input_size))
+        {
+            fprintf(stderr, "failed to write %s\n", options.input);
+            free(column_types);
+            return 1;
+        }
+
+    change_default_settings(options.settings);
+
+    printf("{\"phase\":\"config\",\"rows\":%zu,\"columns\":%zu,\"mix\":[%u,%u,%u],\"nulls\":%g,\"quotes\":%g,"
+           "\"string_width\":%zu,\"number_width\":%zu,\"seed\":%llu,\"repeat\":%zu,\"bytes\":%zu,"
+           "\"threads\":%zu,\"mmap\":%d,\"layout\":\"%s\",\"lazy\":%d,\"dictionary\":%d,\"quoted\":%d}\n",
+           options.rows, options.columns, options.mix[0], options.mix[1], options.mix[2], options.null_ratio, options.quote_ratio,
+           options.string_width, options.number_width, options.seed, options.repeat, input_size,
+           options.settings.thread_count, options.settings.use_mmap, (options.settings.layout == COLUMNAR_LAYOUT) ? "columnar" : "row",
+           options.settings.lazy_types, options.settings.dictionary_encoding, options.settings.quoted_fields);
+    fflush(stdout);
+
+    int status = 0;
+    BENCH_RESULT result;
+
+    if (_bench_parse(&options, &result)) status = 1;
+    else _report("parse", &result, input_size, options.rows);
+
+    // the first column of every type, both directions
+    for (size_t t = 0; t < BENCH_TYPE_COUNT && status == 0; t++)
+        {
+            size_t column = 0;
+            while (column < options.columns && column_types[column] != t) column++;
+            if (column == options.columns) continue;
+
+            for (int direction = ASCENDING; direction <= DESCENDING && status == 0; direction++)
+                {
+                    char phase[32];
+                    snprintf(phase, sizeof(phase), "sort_%s_%s", bench_type_names[t], (direction == ASCENDING) ? "asc" : "desc");
+                    if (_bench_sort(&options, column, (SORT_DIRECTION)direction, &result)) status = 1;
+                    else _report(phase, &result, input_size, options.rows);
+                }
+        }
+
+    size_t output_size = 0;
+    if (status == 0)
+        {
+            if (_bench_save(&options, &result, &output_size)) status = 1;
+            else _report("save", &result, output_size, options.rows);
+        }
+
+    if (status) fprintf(stderr, "benchmark failed, see the parser log\n");
+
+    if (options.keep_files ^ 1)
+        {
+            remove(options.input);
+            remove(options.output);
+        }
+
+    free(column_types);
+    return status;
+}
+
+/* =============== PRIVATE ================ */
+// Options functions
+static int _parse_options(int argc, char** argv, BENCH_OPTIONS* options)
+{
+    options->rows = 1000000;
+    options->columns = 8;
+    options->mix[0] = 1;
+    options->mix[1] = 1;
+    options->mix[2] = 1;
+    options->null_ratio = 0.05;
+    options->quote_ratio = 0.1;
+    options->string_width = 12;
+    options->number_width = 9;
+    options->seed = 1;
+    options->repeat = 3;
+    options->input = "fileparser_bench_input.csv";
+    options->output = "fileparser_bench_output.csv";
+    options->keep_files = 0;
+    options->settings = create_parser_settings();
+
+    for (int i = 1; i < argc; i++)
+        {
+            const char* arg = argv[i];
+            const char* value = strchr(arg, '=');
+            value = (value) ? value + 1 : "";
+
+            if (strncmp(arg, "--rows=", 7) == 0) options->rows = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--columns=", 10) == 0) options->columns = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--mix=", 6) == 0)
+                {
+                    if (_parse_mix(value, options->mix)) return 1;
+                }
+            else if (strncmp(arg, "--nulls=", 8) == 0) options->null_ratio = atof(value);
+            else if (strncmp(arg, "--quotes=", 9) == 0) options->quote_ratio = atof(value);
+            else if (strncmp(arg, "--width=", 8) == 0) options->string_width = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--digits=", 9) == 0) options->number_width = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--seed=", 7) == 0) options->seed = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--repeat=", 9) == 0) options->repeat = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--input=", 8) == 0) options->input = value;
+            else if (strncmp(arg, "--output=", 9) == 0) options->output = value;
+            else if (strcmp(arg, "--keep") == 0) options->keep_files = 1;
+            else if (strncmp(arg, "--threads=", 10) == 0) options->settings.thread_count = strtoull(value, NULL, 10);
+            else if (strcmp(arg, "--mmap") == 0) options->settings.use_mmap = 1;
+            else if (strcmp(arg, "--columnar") == 0) options->settings.layout = COLUMNAR_LAYOUT;
+            else if (strcmp(arg, "--lazy") == 0) options->settings.lazy_types = 1;
+            else if (strcmp(arg, "--dictionary") == 0) options->settings.dictionary_encoding = 1;
+            else if (strcmp(arg, "--quoted") == 0) options->settings.quoted_fields = 1;
+            else
+                {
+                    fprintf(stderr, "unknown option %s\n", arg);
+                    return 1;
+                }
+        }
+
+    if (options->rows == 0 || options->columns == 0 || options->repeat == 0) return 1;
+    if (options->mix[0] + options->mix[1] + options->mix[2] == 0) return 1;
+    if (options->null_ratio < 0 || options->null_ratio > 1 || options->quote_ratio < 0 || options->quote_ratio > 1) return 1;
+    if (options->string_width == 0 || options->number_width == 0 || options->number_width > 18) return 1;
+
+    return 0;
+}
+
+static int _parse_mix(const char* text, unsigned int* mix)
+{
+    char* end;
+    for (size_t t = 0; t < BENCH_TYPE_COUNT; t++)
+        {
+            mix[t] = (unsigned int)strtoul(text, &end, 10);
+            if (end == text) return 1;
+            text = end;
+            if (t + 1 < BENCH_TYPE_COUNT)
+                {
+                    if (*text != ',') return 1;
+                    text++;
+                }
+        }
+
+    return *text != '\0';
+}
+
+static void _print_usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --rows=N         data rows to generate (1000000)\n"
+            "  --columns=N      columns per row (8)\n"
+            "  --mix=I,F,S      weights of integer, float and string columns (1,1,1)\n"
+            "  --nulls=R        share of NULL fields (0.05)\n"
+            "  --quotes=R       share of quoted fields (0.1)\n"
+            "  --width=N        longest string, in letters (12)\n"
+            "  --digits=N       digits of integers and of the integer part of floats, up to 18 (9)\n"
+            "  --seed=N         generator seed (1)\n"
+            "  --repeat=N       runs of every phase, the best is reported (3)\n"
+            "  --input=FILE     generated file (fileparser_bench_input.csv)\n"
+            "  --output=FILE    file written by the save phase (fileparser_bench_output.csv)\n"
+            "  --keep           keep both files\n"
+            "  --threads=N      settings.thread_count, 0 means all cores\n"
+            "  --mmap           settings.use_mmap\n"
+            "  --columnar       settings.layout = COLUMNAR_LAYOUT\n"
+            "  --lazy           settings.lazy_types\n"
+            "  --dictionary     settings.dictionary_encoding\n"
+            "  --quoted         settings.quoted_fields\n",
+            name);
+}
+
+// Generator functions
+static void _assign_column_types(const BENCH_OPTIONS* options, size_t* types)
+{
+    // weighted round robin, every type with a weight shows up as early as possible
+    size_t assigned[BENCH_TYPE_COUNT] = { 0 };
+    for (size_t j = 0; j < options->columns; j++)
+        {
+            size_t best = BENCH_TYPE_COUNT;
+            for (size_t t = 0; t < BENCH_TYPE_COUNT; t++)
+                {
+                    if (options->mix[t] == 0) continue;
+                    // (assigned + 1) / mix, compared without division
+                    if (best == BENCH_TYPE_COUNT || (assigned[t] + 1) * options->mix[best] < (assigned[best] + 1) * options->mix[t])
+                        best = t;
+                }
+
+            types[j] = best;
+            assigned[best]++;
+        }
+}
+
+static int _generate_file(const BENCH_OPTIONS* options, const size_t* types, size_t* size)
+{
+    FILE* file = fopen(options->input, "wb");
+    if (file == NULL) return 1;
+
+    // a field is never longer than both widths plus the fraction, quotes and the splitter,
+    // a header name than the longest type name, '_', 20 digits and the splitter
+    size_t field_width = options->string_width + options->number_width + 8;
+    size_t name_width = 0;
+    for (size_t t = 0; t < BENCH_TYPE_COUNT; t++)
+        {
+            size_t type_width = strlen(bench_type_names[t]) + 22;
+            if (type_width > name_width) name_width = type_width;
+        }
+    size_t capacity = options->columns * (field_width > name_width ? field_width : name_width) + 2;
+    char* line = malloc(capacity);
+    if (line == NULL)
+        {
+            fclose(file);
+            return 1;
+        }
+
+    char splitter = options->settings.splitter;
+    size_t written = 0;
+    size_t length = 0;
+
+    for (size_t j = 0; j < options->columns; j++)
+        {
+            if (j) line[length++] = splitter;
+            length += (size_t)sprintf(line + length, "%s_%zu", bench_type_names[types[j]], j);
+        }
+    line[length++] = '\n';
+    written += fwrite(line, 1, length, file);
+
+    unsigned long long state = options->seed;
+    for (size_t i = 0; i < options->rows; i++)
+        {
+            length = 0;
+            for (size_t j = 0; j < options->columns; j++)
+                {
+                    if (j) line[length++] = splitter;
+                    length += _write_field(line + length, types[j], options, &state);
+                }
+            line[length++] = '\n';
+            written += fwrite(line, 1, length, file);
+        }
+
+    free(line);
+    if (fclose(file) || written == 0) return 1;
+
+    *size = written;
+    return 0;
+}
+
+static unsigned long long _next_random(unsigned long long* state)
+{
+    // splitmix64, the same sequence on every platform
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double _next_unit(unsigned long long* state)
+{
+    return (double)(_next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t _write_field(char* buffer, size_t type, const BENCH_OPTIONS* options, unsigned long long* state)
+{
+    if (_next_unit(state) < options->null_ratio)
+        {
+            // both spellings of NULL the parser knows
+            if (_next_random(state) & 1) return 0;
+            memcpy(buffer, "NULL", 4);
+            return 4;
+        }
+
+    int quoted = _next_unit(state) < options->quote_ratio;
+    size_t length = 0;
+    if (quoted) buffer[length++] = '"';
+
+    unsigned long long limit = 1;
+    for (size_t i = 0; i < options->number_width; i++) limit *= 10;
+
+    switch (bench_types[type])
+        {
+            case INTEGER_TYPE:
+                length += (size_t)sprintf(buffer + length, "%llu", _next_random(state) % limit);
+                break;
+            case FLOAT_TYPE:
+                length += (size_t)sprintf(buffer + length, "%llu.%03llu", _next_random(state) % limit, _next_random(state) % 1000);
+                break;
+            default:
+                {
+                    size_t width = 1 + (size_t)(_next_random(state) % options->string_width);
+                    for (size_t i = 0; i < width; i++) buffer[length++] = (char)('a' + _next_random(state) % 26);
+                    break;
+                }
+        }
+
+    if (quoted) buffer[length++] = '"';
+    return length;
+}
+
+// Benchmark functions
+static P_PARSER _parse_input(const BENCH_OPTIONS* options, double* seconds)
+{
+    P_PARSER parser = create_parser();
+    if (parser == NULL) return NULL;
+
+    double start = _now();
+    if (parse_file(parser, options->input))
+        {
+            free_parser(parser);
+            return NULL;
+        }
+    if (seconds) *seconds = _now() - start;
+
+    return parser;
+}
+
+static int _bench_parse(const BENCH_OPTIONS* options, BENCH_RESULT* result)
+{
+    memset(result, 0, sizeof(BENCH_RESULT));
+    for (size_t run = 0; run < options->repeat; run++)
+        {
+            double seconds;
+            P_PARSER parser = _parse_input(options, &seconds);
+            if (parser == NULL) return 1;
+            _add_run(result, seconds);
+            free_parser(parser);
+        }
+
+    return 0;
+}
+
+static int _bench_sort(const BENCH_OPTIONS* options, size_t column, SORT_DIRECTION direction, BENCH_RESULT* result)
+{
+    memset(result, 0, sizeof(BENCH_RESULT));
+    for (size_t run = 0; run < options->repeat; run++)
+        {
+            // every run sorts freshly parsed rows, so the input order is always the file order
+            P_PARSER parser = _parse_input(options, NULL);
+            if (parser == NULL) return 1;
+
+            PARSER_SORT_SETTINGS sort_settings = create_parser_sort_settings();
+            sort_settings.tag = COLUMN_INDEX;
+            sort_settings.value.column_index = column;
+            sort_settings.direction = direction;
+
+            double start = _now();
+            int failed = sort_data(parser, sort_settings);
+            double seconds = _now() - start;
+
+            free_parser(parser);
+            if (failed) return 1;
+            _add_run(result, seconds);
+        }
+
+    return 0;
+}
+
+static int _bench_save(const BENCH_OPTIONS* options, BENCH_RESULT* result, size_t* size)
+{
+    memset(result, 0, sizeof(BENCH_RESULT));
+    P_PARSER parser = _parse_input(options, NULL);
+    if (parser == NULL) return 1;
+
+    for (size_t run = 0; run < options->repeat; run++)
+        {
+            double start = _now();
+            if (save_data(parser, options->output))
+                {
+                    free_parser(parser);
+                    return 1;
+                }
+            _add_run(result, _now() - start);
+        }
+
+    free_parser(parser);
+    *size = _file_size(options->output);
+    return 0;
+}
+
+static void _add_run(BENCH_RESULT* result, double seconds)
+{
+    if (result->runs == 0 || seconds < result->best) result->best = seconds;
+    result->total += seconds;
+    result->runs++;
+}
+
+static void _report(const char* phase, const BENCH_RESULT* result, size_t bytes, size_t rows)
+{
+    // rates come from the best run, peak_rss_kb is the peak of the whole process so far
+    double best = (result->best > 0) ? result->best : 1e-9;
+    printf("{\"phase\":\"%s\",\"runs\":%zu,\"seconds\":%.6f,\"mean_seconds\":%.6f,\"bytes\":%zu,\"rows\":%zu,"
+           "\"mb_per_s\":%.2f,\"rows_per_s\":%.0f,\"peak_rss_kb\":%zu}\n",
+           phase, result->runs, result->best, result->total / (double)result->runs, bytes, rows,
+           (double)bytes / (1024.0 * 1024.0) / best, (double)rows / best, _peak_rss_kb());
+    fflush(stdout);
+}
+
+// Utilities
+static double _now()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+static size_t _peak_rss_kb()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0) return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+static size_t _file_size(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return (size < 0) ? 0 : (size_t)size;
+}
@@ -0,0 +1,378 @@
+/**
+ * Made by Arseniy Kuskov
+ * This file has no copyright assigned and is placed in the Public Domain.
+ * No warranty is given.
+ */
+
+/**
+ * Concurrency check for independent parsers.
+ * Generates a deterministic CSV file, then every worker thread creates its own parser, parses the file,
+ * sorts it and saves it, round after round, with its own mix of settings, while one more thread keeps
+ * calling change_default_settings. Every saved file has to be byte for byte the same.
+ * Needs the library built with threads (no FILEPARSER_NO_THREADS).
+ *
+ * gcc -O2 -DLOG_LEVEL=LOGLEVEL_NONE fileparser_concurrency.c fileparser.c -o fileparser_concurrency -pthread
+ * ./fileparser_concurrency --workers=12 --rounds=3 --rows=20000
+ */
+
+#include "fileparser.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* =============== MACROS ================ */
+#define CHECK_MODE_COUNT 3
+#define CHECK_NAME_SIZE 128
+
+/* =============== TYPES ================ */
+typedef struct __check_options
+{
+    size_t workers;
+    size_t rounds; // parse, sort and save cycles of every worker
+    size_t rows;
+    unsigned long long seed;
+    const char* input; // generated file
+    const char* output; // prefix of the files written by the workers
+    int keep_files;
+} CHECK_OPTIONS;
+
+typedef struct __check_defaults CHECK_DEFAULTS;
+
+typedef struct __check_worker
+{
+    pthread_t thread;
+    const CHECK_OPTIONS* options;
+    CHECK_DEFAULTS* defaults; // told when the worker is done
+    PARSER_SETTINGS settings;
+    size_t index;
+    int failed;
+} CHECK_WORKER;
+
+struct __check_defaults
+{
+    pthread_t thread;
+    PARSER_SETTINGS settings;
+    pthread_mutex_t lock;
+    size_t running; // workers that have not finished yet
+    size_t changes;
+};
+
+// every worker gets one of them, the rest of its settings comes from its index
+static const char* check_mode_names[CHECK_MODE_COUNT] = { "row", "lazy", "columnar" };
+
+/* =============== PRIVATE DECLARATIONS ================ */
+static int _parse_options(int argc, char** argv, CHECK_OPTIONS* options);
+static void _print_usage(const char* name);
+static int _generate_file(const CHECK_OPTIONS* options, char splitter);
+static unsigned long long _next_random(unsigned long long* state);
+static void _worker_settings(PARSER_SETTINGS base, size_t index, PARSER_SETTINGS* settings);
+static void _output_name(const CHECK_OPTIONS* options, size_t worker, size_t round, char* name);
+static void* _run_worker(void* argument);
+static void* _run_defaults(void* argument);
+static int _same_file(const char* first, const char* second);
+
+/* =============== MAIN ================ */
+int main(int argc, char** argv)
+{
+    CHECK_OPTIONS options;
+    if (_parse_options(argc, argv, &options))
+        {
+            _print_usage(argv[0]);
+            return 1;
+        }
+
+    CHECK_DEFAULTS defaults;
+    defaults.settings = create_parser_settings();
+    defaults.running = options.workers;
+    defaults.changes = 0;
+
+    if (_generate_file(&options, defaults.settings.splitter))
+        {
+            fprintf(stderr, "failed to write %s\n", options.input);
+            return 1;
+        }
+
+    CHECK_WORKER* workers = calloc(options.workers, sizeof(CHECK_WORKER));
+    if (workers == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            remove(options.input);
+            return 1;
+        }
+
+    pthread_mutex_init(&defaults.lock, NULL);
+
+    for (size_t i = 0; i < options.workers; i++)
+        {
+            workers[i].options = &options;
+            workers[i].defaults = &defaults;
+            workers[i].index = i;
+            _worker_settings(defaults.settings, i, &workers[i].settings);
+        }
+
+    // the defaults thread runs until the last worker is done, so every parse overlaps a change
+    int status = 0;
+    size_t started = 0;
+    if (pthread_create(&defaults.thread, NULL, _run_defaults, &defaults))
+        {
+            fprintf(stderr, "failed to start the defaults thread\n");
+            status = 1;
+        }
+    else
+        {
+            for (; started < options.workers; started++)
+                if (pthread_create(&workers[started].thread, NULL, _run_worker, &workers[started])) break;
+
+            pthread_mutex_lock(&defaults.lock);
+            defaults.running -= options.workers - started;
+            pthread_mutex_unlock(&defaults.lock);
+
+            for (size_t i = 0; i < started; i++) pthread_join(workers[i].thread, NULL);
+            pthread_join(defaults.thread, NULL);
+
+            if (started < options.workers)
+                {
+                    fprintf(stderr, "failed to start worker %zu\n", started);
+                    status = 1;
+                }
+        }
+
+    char reference[CHECK_NAME_SIZE];
+    char name[CHECK_NAME_SIZE];
+    _output_name(&options, 0, 0, reference);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < started; i++)
+        {
+            if (workers[i].failed)
+                {
+                    fprintf(stderr, "worker %zu (%s) failed, see the parser log\n", i, check_mode_names[(i >> 2) % CHECK_MODE_COUNT]);
+                    status = 1;
+                    continue;
+                }
+
+            for (size_t round = 0; round < options.rounds; round++)
+                {
+                    _output_name(&options, i, round, name);
+                    if (_same_file(reference, name) == 0)
+                        {
+                            fprintf(stderr, "%s differs from %s\n", name, reference);
+                            mismatches++;
+                        }
+                }
+        }
+    if (mismatches) status = 1;
+
+    printf("{\"workers\":%zu,\"rounds\":%zu,\"rows\":%zu,\"default_changes\":%zu,\"mismatches\":%zu,\"status\":\"%s\"}\n",
+           options.workers, options.rounds, options.rows, defaults.changes, mismatches, status ? "failed" : "ok");
+
+    if (options.keep_files ^ 1)
+        {
+            remove(options.input);
+            for (size_t i = 0; i < options.workers; i++)
+                for (size_t round = 0; round < options.rounds; round++)
+                    {
+                        _output_name(&options, i, round, name);
+                        remove(name);
+                    }
+        }
+
+    pthread_mutex_destroy(&defaults.lock);
+    free(workers);
+    return status;
+}
+
+/* =============== PRIVATE ================ */
+// Options functions
+static int _parse_options(int argc, char** argv, CHECK_OPTIONS* options)
+{
+    options->workers = 12;
+    options->rounds = 3;
+    options->rows = 20000;
+    options->seed = 1;
+    options->input = "fileparser_concurrency_input.csv";
+    options->output = "fileparser_concurrency_output";
+    options->keep_files = 0;
+
+    for (int i = 1; i < argc; i++)
+        {
+            const char* arg = argv[i];
+            const char* value = strchr(arg, '=');
+            value = (value) ? value + 1 : "";
+
+            if (strncmp(arg, "--workers=", 10) == 0) options->workers = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--rounds=", 9) == 0) options->rounds = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--rows=", 7) == 0) options->rows = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--seed=", 7) == 0) options->seed = strtoull(value, NULL, 10);
+            else if (strncmp(arg, "--input=", 8) == 0) options->input = value;
+            else if (strncmp(arg, "--output=", 9) == 0) options->output = value;
+            else if (strcmp(arg, "--keep") == 0) options->keep_files = 1;
+            else return 1;
+        }
+
+    if (options->workers == 0 || options->rounds == 0 || options->rows == 0) return 1;
+    if (strlen(options->output) + 48 > CHECK_NAME_SIZE) return 1;
+    return 0;
+}
+
+static void _print_usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --workers=N      parsing threads, each one with its own parser (12)\n"
+            "  --rounds=N       parse, sort and save cycles of every worker (3)\n"
+            "  --rows=N         data rows to generate (20000)\n"
+            "  --seed=N         generator seed (1)\n"
+            "  --input=FILE     generated file (fileparser_concurrency_input.csv)\n"
+            "  --output=PREFIX  prefix of the saved files (fileparser_concurrency_output)\n"
+            "  --keep           keep every file\n",
+            name);
+}
+
+// Generator functions
+static int _generate_file(const CHECK_OPTIONS* options, char splitter)
+{
+    FILE* file = fopen(options->input, "wb");
+    if (file == NULL) return 1;
+
+    // an integer key with many repeats, so the sort has to be stable to give the same bytes,
+    // a float, a string that is sometimes quoted and a column with NULLs
+    fprintf(file, "id%ckey%cvalue%cname%cnote\n", splitter, splitter, splitter, splitter);
+
+    unsigned long long state = options->seed;
+    for (size_t i = 0; i < options->rows; i++)
+        {
+            unsigned long long random = _next_random(&state);
+            char name[16];
+            size_t width = 1 + (size_t)(random % 10);
+            for (size_t j = 0; j < width; j++) name[j] = (char)('a' + (_next_random(&state) % 26));
+            name[width] = '\0';
+
+            const char* quote = (random & 0x100) ? "\"" : "";
+            fprintf(file, "%zu%c%llu%c%llu.%02llu%c%s%s%s%c", i, splitter, (random >> 16) % 97, splitter, (random >> 24) % 100000, (random >> 40) % 100,
+                    splitter, quote, name, quote, splitter);
+            if (random & 0x200) fprintf(file, "NULL\n");
+            else fprintf(file, "%llu\n", (random >> 48) % 1000);
+        }
+
+    return (fclose(file) != 0);
+}
+
+static unsigned long long _next_random(unsigned long long* state)
+{
+    // splitmix64, the same sequence on every platform
+    unsigned long long z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Worker functions
+static void _worker_settings(PARSER_SETTINGS base, size_t index, PARSER_SETTINGS* settings)
+{
+    // the low bits pick stdio or mmap and one or two parse threads, the rest the layout,
+    // so the default 12 workers cover every combination once
+    *settings = base;
+    settings->use_mmap = (int)(index & 1);
+    settings->thread_count = (index & 2) ? 2 : 1;
+
+    switch ((index >> 2) % CHECK_MODE_COUNT)
+        {
+            case 1:
+                settings->lazy_types = 1;
+                break;
+            case 2:
+                settings->layout = COLUMNAR_LAYOUT;
+                break;
+            default:
+                break;
+        }
+}
+
+static void _output_name(const CHECK_OPTIONS* options, size_t worker, size_t round, char* name)
+{
+    snprintf(name, CHECK_NAME_SIZE, "%s_%zu_%zu.csv", options->output, worker, round);
+}
+
+static void* _run_worker(void* argument)
+{
+    CHECK_WORKER* worker = argument;
+    char name[CHECK_NAME_SIZE];
+
+    for (size_t round = 0; round < worker->options->rounds && worker->failed == 0; round++)
+        {
+            P_PARSER parser = create_parser();
+            if (parser == NULL)
+                {
+                    worker->failed = 1;
+                    break;
+                }
+            parser->settings = worker->settings;
+
+            PARSER_SORT_SETTINGS sort_settings = create_parser_sort_settings();
+            sort_settings.tag = COLUMN_INDEX;
+            sort_settings.value.column_index = 1;
+            sort_settings.direction = ASCENDING;
+
+            _output_name(worker->options, worker->index, round, name);
+            if (parse_file(parser, worker->options->input) || sort_data(parser, sort_settings) || save_data(parser, name))
+                worker->failed = 1;
+
+            free_parser(parser);
+        }
+
+    pthread_mutex_lock(&worker->defaults->lock);
+    worker->defaults->running--;
+    pthread_mutex_unlock(&worker->defaults->lock);
+    return NULL;
+}
+
+static void* _run_defaults(void* argument)
+{
+    CHECK_DEFAULTS* defaults = argument;
+
+    // flips the defaults between two settings, create_parser copies them but every worker
+    // replaces the copy, so only a torn copy or a race in the library could change the output
+    PARSER_SETTINGS changed = defaults->settings;
+    changed.splitter = (defaults->settings.splitter == ',') ? ';' : ',';
+    changed.thread_count = 3;
+    changed.layout = COLUMNAR_LAYOUT;
+
+    for (;;)
+        {
+            pthread_mutex_lock(&defaults->lock);
+            size_t running = defaults->running;
+            pthread_mutex_unlock(&defaults->lock);
+            if (running == 0) break;
+
+            change_default_settings((defaults->changes & 1) ? defaults->settings : changed);
+            change_default_sort_settings(create_parser_sort_settings());
+            defaults->changes++;
+        }
+
+    change_default_settings(defaults->settings);
+    return NULL;
+}
+
+// Utilities
+static int _same_file(const char* first, const char* second)
+{
+    FILE* a = fopen(first, "rb");
+    FILE* b = fopen(second, "rb");
+    int same = (a != NULL && b != NULL);
+
+    char left[4096];
+    char right[4096];
+    while (same)
+        {
+            size_t left_size = fread(left, 1, sizeof(left), a);
+            size_t right_size = fread(right, 1, sizeof(right), b);
+            if (left_size != right_size || memcmp(left, right, left_size) != 0) same = 0;
+            else if (left_size == 0) break;
+        }
+
+    if (a) fclose(a);
+    if (b) fclose(b);
+    return same;
+}